@@ -0,0 +1,68 @@
+-- Messages exchanged between VMs running on different threads (every worker
+-- gets its own execution context).
+--
+-- `actor_cross_thread/ping_pong` measures round-trips with one worker.
+-- `actor_cross_thread/fan_in/p<N>` has N workers pushing messages through
+-- `try_send()` while the main VM drains its inbox with `receive_many()` (one op
+-- is one message received).
+
+local harness = require('./harness')
+local inbox = require('inbox')
+
+local N = 100000
+local BATCH = 256
+
+if _CONTEXT == 'main' then
+    local function spawn_worker()
+        local ch = spawn_vm{ module = '.', inherit_context = false }
+        ch:send(inbox)
+        return ch
+    end
+
+    local pong = spawn_worker()
+    harness.measure('actor_cross_thread/ping_pong', N, function()
+        for _ = 1, N do
+            pong:send('ping')
+            inbox:receive()
+        end
+    end)
+    pong:send('quit')
+
+    for _, nproducers in ipairs{1, 4} do
+        local producers = {}
+        for i = 1, nproducers do
+            producers[i] = spawn_worker()
+        end
+
+        local per_producer = N / nproducers
+        harness.measure(
+            string.format('actor_cross_thread/fan_in/p%d', nproducers), N,
+            function()
+                for _, p in ipairs(producers) do
+                    p:send(per_producer)
+                end
+                local received = 0
+                while received < N do
+                    received = received + #inbox:receive_many(BATCH)
+                end
+            end)
+
+        for _, p in ipairs(producers) do
+            p:send('quit')
+        end
+    end
+else assert(_CONTEXT == 'worker')
+    local parent = inbox:receive()
+    while true do
+        local m = inbox:receive()
+        if m == 'quit' then
+            break
+        elseif m == 'ping' then
+            parent:send(m)
+        else
+            for i = 1, m do
+                assert(parent:try_send(i))
+            end
+        end
+    end
+end
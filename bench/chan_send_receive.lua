@@ -0,0 +1,46 @@
+-- Messages exchanged between two VMs sharing the same execution context (i.e.
+-- chan_send()/chan_receive() without any thread hop). `burst` measures one-way
+-- throughput and `ping_pong` measures round-trips. allocs/op only covers the
+-- sending VM.
+
+local harness = require('./harness')
+local inbox = require('inbox')
+
+local N = 100000
+
+if _CONTEXT == 'main' then
+    local ch = spawn_vm('.')
+    ch:send(inbox)
+
+    harness.measure('chan_send_receive/burst', N, function()
+        for _ = 1, N do
+            ch:send(1)
+        end
+        assert(inbox:receive() == 'done')
+    end)
+
+    harness.measure('chan_send_receive/ping_pong', N, function()
+        for _ = 1, N do
+            ch:send(2)
+            inbox:receive()
+        end
+    end)
+
+    ch:send(0)
+else assert(_CONTEXT == 'worker')
+    local parent = inbox:receive()
+    local received = 0
+    while true do
+        local m = inbox:receive()
+        if m == 0 then
+            break
+        elseif m == 1 then
+            received = received + 1
+            if received == N then
+                parent:send('done')
+            end
+        else
+            parent:send(m)
+        end
+    end
+end
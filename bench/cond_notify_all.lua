@@ -0,0 +1,56 @@
+-- notify_all() storms. Every round wakes up all waiters at once and they all
+-- contend for the mutex on their way out of wait().
+--
+-- One op is one woken up waiter.
+
+local harness = require('./harness')
+local mutex = require('mutex')
+local condition_variable = require('condition_variable')
+
+local function run(nwaiters, rounds)
+    local m = mutex.new()
+    local wake_up = condition_variable.new()
+    local all_arrived = condition_variable.new()
+    local generation = 0
+    local arrived = 0
+
+    local waiters = {}
+    for i = 1, nwaiters do
+        waiters[i] = spawn(function()
+            m:lock()
+            for _ = 1, rounds do
+                local gen = generation
+                arrived = arrived + 1
+                if arrived == nwaiters then
+                    all_arrived:notify_one()
+                end
+                while generation == gen do
+                    wake_up:wait(m)
+                end
+            end
+            m:unlock()
+        end)
+    end
+
+    harness.measure(
+        string.format('cond_notify_all/%d', nwaiters), nwaiters * rounds,
+        function()
+            m:lock()
+            for _ = 1, rounds do
+                while arrived < nwaiters do
+                    all_arrived:wait(m)
+                end
+                arrived = 0
+                generation = generation + 1
+                wake_up:notify_all()
+            end
+            m:unlock()
+            for _, f in ipairs(waiters) do
+                f:join()
+            end
+        end)
+end
+
+run(10, 10000)
+run(100, 1000)
+run(1000, 100)
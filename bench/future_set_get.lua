@@ -0,0 +1,26 @@
+-- Promise/future pairs. `ready` measures get() on a future whose value is
+-- already set. `handoff` measures a fiber blocked on get() being woken up by
+-- set_value().
+
+local harness = require('./harness')
+local future = require('future')
+
+local N = 100000
+
+harness.measure('future_set_get/ready', N, function()
+    for _ = 1, N do
+        local p, f = future.new()
+        p:set_value(1)
+        f:get()
+    end
+end)
+
+harness.measure('future_set_get/handoff', N, function()
+    for _ = 1, N do
+        local p, f = future.new()
+        local waiter = spawn(function() f:get() end)
+        this_fiber.yield()
+        p:set_value(1)
+        waiter:join()
+    end
+end)
@@ -0,0 +1,42 @@
+-- Shared driver for the benchmarks in this directory.
+--
+-- Output: one `name<TAB>ops/s<TAB>ns/op<TAB>allocs/op` line per measurement.
+-- allocs/op counts the blocks allocated by the Lua heap of the calling VM while
+-- the measurement runs (see `this_vm.stats()`), so work done on behalf of the
+-- benchmark by other VMs is not included.
+--
+-- Latency distributions are reported as one
+-- `name<TAB>p50<TAB>p99<TAB>p99.9` line (nanoseconds) instead.
+
+local clock = require('time').steady_clock
+
+-- this_vm.stats() allocates its result table, so measure how much that costs
+-- once and discount it from every sample
+local stats_allocs
+do
+    local a = this_vm.stats().allocations
+    stats_allocs = this_vm.stats().allocations - a
+end
+
+-- `fn()` must perform `ops` operations
+function measure(name, ops, fn)
+    collectgarbage()
+    local allocs = this_vm.stats().allocations
+    local start = clock.now_ns()
+    fn()
+    local ns = clock.now_ns() - start
+    allocs = this_vm.stats().allocations - allocs - stats_allocs
+
+    print(string.format('%s\t%.0f\t%.1f\t%.2f',
+                        name, ops * 1e9 / ns, ns / ops, allocs / ops))
+end
+
+-- `samples` is an array of durations in nanoseconds (it's sorted in place)
+function percentiles(name, samples)
+    table.sort(samples)
+    local function at(p)
+        return samples[math.max(1, math.ceil(#samples * p))]
+    end
+    print(string.format('%s\t%.0f\t%.0f\t%.0f',
+                        name, at(0.5), at(0.99), at(0.999)))
+end
@@ -0,0 +1,108 @@
+-- Message passing to a sandboxed actor (spawn_vm() with `subprocess`) for the
+-- message shapes the IPC transport supports. `burst` measures one-way
+-- throughput and `ping_pong` measures round-trips (latency percentiles are
+-- reported as well).
+--
+-- Messages crossing process boundaries can't nest tables, so `dict` and
+-- `dict_strings` use the flat tables with the largest number of members that
+-- fit within the default build limits instead.
+
+local harness = require('./harness')
+local inbox = require('inbox')
+local pipe = require('pipe')
+
+local clock = require('time').steady_clock
+
+local N = 20000
+local NROUND_TRIPS = 5000
+
+local function release(m)
+    if type(m) == 'userdata' then
+        m:close()
+    end
+end
+
+if _CONTEXT ~= 'main' then
+    while true do
+        local cfg = inbox:receive()
+        if cfg.mode == 'exit' then
+            break
+        elseif cfg.mode == 'burst' then
+            for _ = 1, cfg.count do
+                release(inbox:receive())
+            end
+            cfg.dest:send('done')
+        else assert(cfg.mode == 'ping_pong')
+            for _ = 1, cfg.count do
+                local m = inbox:receive()
+                cfg.dest:send(m)
+                release(m)
+            end
+        end
+    end
+    return
+end
+
+local shapes = {}
+
+shapes[#shapes + 1] = { 'flat', 42 }
+
+do
+    local dict = {}
+    for i = 1, 16 do
+        dict['k' .. i] = i
+    end
+    shapes[#shapes + 1] = { 'dict', dict }
+end
+
+shapes[#shapes + 1] = { 'string_255', string.rep('x', 255) }
+
+do
+    local dict = {}
+    for i = 1, 16 do
+        dict['k' .. i] = string.rep('x', 255)
+    end
+    shapes[#shapes + 1] = { 'dict_strings', dict }
+end
+
+do
+    local rd, wr = pipe.pair()
+    wr:close()
+    shapes[#shapes + 1] = { 'fd', rd:release() }
+end
+
+local ch = spawn_vm{
+    module = tostring(_FILE),
+    subprocess = {
+        stdout = 'share',
+        stderr = 'share',
+    }
+}
+
+for _, shape in ipairs(shapes) do
+    local name, msg = shape[1], shape[2]
+
+    ch:send{ mode = 'burst', count = N, dest = inbox }
+    harness.measure('ipc_actor_chan/burst/' .. name, N, function()
+        for _ = 1, N do
+            ch:send(msg)
+        end
+        assert(inbox:receive() == 'done')
+    end)
+
+    local samples = {}
+    ch:send{ mode = 'ping_pong', count = NROUND_TRIPS, dest = inbox }
+    harness.measure(
+        'ipc_actor_chan/ping_pong/' .. name, NROUND_TRIPS,
+        function()
+            for i = 1, NROUND_TRIPS do
+                local start = clock.now_ns()
+                ch:send(msg)
+                release(inbox:receive())
+                samples[i] = clock.now_ns() - start
+            end
+        end)
+    harness.percentiles('ipc_actor_chan_latency/' .. name, samples)
+end
+
+ch:send{ mode = 'exit' }
@@ -0,0 +1,31 @@
+-- Lock handoff between contending fibers. Every fiber holds the mutex across a
+-- suspension so the others pile up as waiters and each unlock() hands the
+-- mutex over to the next one in line.
+
+local harness = require('./harness')
+local mutex = require('mutex')
+
+local function run(nfibers, iterations)
+    local m = mutex.new()
+    harness.measure(
+        string.format('mutex_handoff/%d', nfibers), nfibers * iterations,
+        function()
+            local fibers = {}
+            for i = 1, nfibers do
+                fibers[i] = spawn(function()
+                    for _ = 1, iterations do
+                        m:lock()
+                        this_fiber.yield()
+                        m:unlock()
+                    end
+                end)
+            end
+            for _, f in ipairs(fibers) do
+                f:join()
+            end
+        end)
+end
+
+run(2, 100000)
+run(100, 2000)
+run(1000, 200)
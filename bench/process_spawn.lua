@@ -0,0 +1,49 @@
+-- Process start-up costs. `system_spawn` measures system.spawn() (the clone()
+-- path on Linux) followed by wait() on a program that exits right away.
+-- `spawn_vm_subprocess` measures how long a sandboxed actor takes from
+-- spawn_vm() until its first message arrives back at the parent.
+
+local harness = require('./harness')
+local inbox = require('inbox')
+local system = require('system')
+
+local clock = require('time').steady_clock
+
+local N = 500
+
+if _CONTEXT ~= 'main' then
+    local dest = inbox:receive()
+    dest:send('ready')
+    return
+end
+
+local samples = {}
+harness.measure('system_spawn', N, function()
+    for i = 1, N do
+        local start = clock.now_ns()
+        local p = system.spawn{ program = 'true', arguments = { 'true' } }
+        p:wait()
+        samples[i] = clock.now_ns() - start
+    end
+end)
+harness.percentiles('system_spawn_latency', samples)
+
+local NVMS = 100
+
+samples = {}
+harness.measure('spawn_vm_subprocess', NVMS, function()
+    for i = 1, NVMS do
+        local start = clock.now_ns()
+        local ch = spawn_vm{
+            module = tostring(_FILE),
+            subprocess = {
+                stdout = 'share',
+                stderr = 'share',
+            }
+        }
+        ch:send(inbox)
+        assert(inbox:receive() == 'ready')
+        samples[i] = clock.now_ns() - start
+    end
+end)
+harness.percentiles('spawn_vm_subprocess_latency', samples)
@@ -0,0 +1,35 @@
+-- Overhead of the fiber-aware shims for protected calls and cleanup scopes.
+
+local harness = require('./harness')
+
+local N = 1000000
+
+local function noop() end
+local function cleanup_push_pop()
+    scope_cleanup_push(noop)
+    scope_cleanup_pop()
+end
+
+harness.measure('scope_pcall/pcall', N, function()
+    for _ = 1, N do
+        pcall(noop)
+    end
+end)
+
+harness.measure('scope_pcall/pcall_error', N, function()
+    for _ = 1, N do
+        pcall(error, 'e')
+    end
+end)
+
+harness.measure('scope_pcall/scope', N, function()
+    for _ = 1, N do
+        scope(noop)
+    end
+end)
+
+harness.measure('scope_pcall/scope_cleanup', N, function()
+    for _ = 1, N do
+        scope(cleanup_push_pop)
+    end
+end)
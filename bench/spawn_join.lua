@@ -0,0 +1,26 @@
+-- spawn() immediately followed by join(). The joined fiber finishes on its
+-- first resume so this mostly measures fiber creation, scheduling and
+-- teardown (including the recycling of finished fibers).
+
+local harness = require('./harness')
+
+local function noop() end
+
+harness.measure('spawn_join/sequential', 100000, function()
+    for _ = 1, 100000 do
+        spawn(noop):join()
+    end
+end)
+
+-- a batch of live fibers at once defeats the recycling of finished fibers
+harness.measure('spawn_join/batch_1000', 100000, function()
+    local fibers = {}
+    for _ = 1, 100 do
+        for i = 1, 1000 do
+            fibers[i] = spawn(noop)
+        end
+        for i = 1, 1000 do
+            fibers[i]:join()
+        end
+    end
+end)
@@ -0,0 +1,219 @@
+-- Echo over loopback transports (ip.tcp.socket, unix.stream_socket, pipe.pair
+-- and tls.socket) for varying buffer sizes and connection counts. Each
+-- connection has a server fiber that echoes whatever it receives through
+-- read_some() and stream.write_all().
+--
+-- `stream_echo/<transport>/c<conns>/b<bytes>` measures throughput (one op is
+-- one buffer echoed back and fully read through stream.read_all()).
+-- `stream_echo_latency/<transport>/c<conns>/b<bytes>` reports round-trip
+-- percentiles.
+--
+-- TLS runs need a certificate and its private key (PEM) given as script
+-- arguments (`emilua stream_echo.lua -- CERT KEY`). The meson benchmark target
+-- generates a self-signed pair at build time when openssl is available.
+
+local harness = require('./harness')
+local stream = require('stream')
+local system = require('system')
+local filesystem = require('filesystem')
+local ip = require('ip')
+local unix = require('unix')
+local pipe = require('pipe')
+local tls = require('tls')
+
+local clock = require('time').steady_clock
+
+local THROUGHPUT_BYTES = 64 * 1024 * 1024
+local LATENCY_ROUNDS = 10000
+
+local function tcp_connect_pair(acceptor)
+    local client = ip.tcp.socket.new()
+    local server
+    local f = spawn(function() server = acceptor:accept() end)
+    client:connect(ip.address.loopback_v4(), acceptor.local_port)
+    f:join()
+    client:set_option('tcp_no_delay', true)
+    server:set_option('tcp_no_delay', true)
+    return client, server
+end
+
+local function with_acceptor(fn)
+    local acceptor = ip.tcp.acceptor.new()
+    acceptor:open('v4')
+    acceptor:bind(ip.address.loopback_v4(), 0)
+    acceptor:listen()
+    local ret = fn(acceptor)
+    acceptor:close()
+    return ret
+end
+
+-- Every factory returns an array of connections. A connection is
+-- `{ client_rd, client_wr, server_rd, server_wr, close = function }`.
+local transports = {}
+
+transports[#transports + 1] = { 'tcp', function(n)
+    return with_acceptor(function(acceptor)
+        local ret = {}
+        for i = 1, n do
+            local c, s = tcp_connect_pair(acceptor)
+            ret[i] = { c, c, s, s, close = function()
+                c:close()
+                s:close()
+            end }
+        end
+        return ret
+    end)
+end }
+
+transports[#transports + 1] = { 'unix', function(n)
+    local ret = {}
+    for i = 1, n do
+        local c, s = unix.stream_socket.pair()
+        ret[i] = { c, c, s, s, close = function()
+            c:close()
+            s:close()
+        end }
+    end
+    return ret
+end }
+
+transports[#transports + 1] = { 'pipe', function(n)
+    local ret = {}
+    for i = 1, n do
+        local srd, cwr = pipe.pair()
+        local crd, swr = pipe.pair()
+        ret[i] = { crd, cwr, srd, swr, close = function()
+            crd:close()
+            cwr:close()
+            srd:close()
+            swr:close()
+        end }
+    end
+    return ret
+end }
+
+local args = system.arguments
+if args[3] and args[4] then
+    local server_ctx = tls.context.new('tls_server')
+    server_ctx:use_certificate_chain_file(
+        filesystem.path.from_generic(args[3]))
+    server_ctx:use_private_key_file(
+        filesystem.path.from_generic(args[4]), 'pem')
+    local client_ctx = tls.context.new('tls_client')
+
+    transports[#transports + 1] = { 'tls', function(n)
+        return with_acceptor(function(acceptor)
+            local ret = {}
+            for i = 1, n do
+                local c, s = tcp_connect_pair(acceptor)
+                c = tls.socket.new(c, client_ctx)
+                s = tls.socket.new(s, server_ctx)
+                local f = spawn(function() s:server_handshake() end)
+                c:client_handshake()
+                f:join()
+                -- TLS sockets are closed when collected
+                ret[i] = { c, c, s, s, close = function() end }
+            end
+            return ret
+        end)
+    end }
+else
+    print('stream_echo: no certificate given, skipping tls')
+end
+
+local function echo(rd, wr, bufsize)
+    local buf = byte_span.new(bufsize)
+    while true do
+        local nread = rd:read_some(buf)
+        stream.write_all(wr, buf:slice(1, nread))
+    end
+end
+
+local function start_servers(conns, bufsize)
+    local servers = {}
+    for i, conn in ipairs(conns) do
+        servers[i] = spawn(function() echo(conn[3], conn[4], bufsize) end)
+    end
+    return function()
+        for _, f in ipairs(servers) do
+            f:interrupt()
+            f:join()
+        end
+        for _, conn in ipairs(conns) do
+            conn.close()
+        end
+    end
+end
+
+local function throughput(name, factory, nconns, bufsize)
+    local conns = factory(nconns)
+    local stop = start_servers(conns, bufsize)
+    local rounds = math.max(1, THROUGHPUT_BYTES / bufsize / nconns)
+
+    harness.measure(
+        string.format('stream_echo/%s/c%d/b%d', name, nconns, bufsize),
+        rounds * nconns,
+        function()
+            local fibers = {}
+            for _, conn in ipairs(conns) do
+                fibers[#fibers + 1] = spawn(function()
+                    local buf = byte_span.new(bufsize)
+                    for _ = 1, rounds do
+                        stream.write_all(conn[2], buf)
+                    end
+                end)
+                fibers[#fibers + 1] = spawn(function()
+                    local buf = byte_span.new(bufsize)
+                    for _ = 1, rounds do
+                        stream.read_all(conn[1], buf)
+                    end
+                end)
+            end
+            for _, f in ipairs(fibers) do
+                f:join()
+            end
+        end)
+
+    stop()
+end
+
+local function latency(name, factory, nconns, bufsize)
+    local conns = factory(nconns)
+    local stop = start_servers(conns, bufsize)
+    local rounds = math.max(1, LATENCY_ROUNDS / nconns)
+
+    local samples = {}
+    local fibers = {}
+    for i, conn in ipairs(conns) do
+        fibers[i] = spawn(function()
+            local buf = byte_span.new(bufsize)
+            for _ = 1, rounds do
+                local start = clock.now_ns()
+                stream.write_all(conn[2], buf)
+                stream.read_all(conn[1], buf)
+                samples[#samples + 1] = clock.now_ns() - start
+            end
+        end)
+    end
+    for _, f in ipairs(fibers) do
+        f:join()
+    end
+    harness.percentiles(
+        string.format('stream_echo_latency/%s/c%d/b%d',
+                      name, nconns, bufsize),
+        samples)
+
+    stop()
+end
+
+for _, t in ipairs(transports) do
+    local name, factory = t[1], t[2]
+    for _, nconns in ipairs{1, 16} do
+        for _, bufsize in ipairs{64, 4096, 65536} do
+            throughput(name, factory, nconns, bufsize)
+        end
+        for _, bufsize in ipairs{64, 4096} do
+            latency(name, factory, nconns, bufsize)
+        end
+    end
+end
@@ -0,0 +1,26 @@
+-- this_fiber.yield() round-trips through the scheduler. One op is one yield()
+-- call.
+
+local harness = require('./harness')
+
+local function run(nfibers, iterations)
+    harness.measure(
+        string.format('yield/%d', nfibers), nfibers * iterations,
+        function()
+            local fibers = {}
+            for i = 1, nfibers do
+                fibers[i] = spawn(function()
+                    for _ = 1, iterations do
+                        this_fiber.yield()
+                    end
+                end)
+            end
+            for _, f in ipairs(fibers) do
+                f:join()
+            end
+        end)
+end
+
+run(1, 200000)
+run(100, 2000)
+run(1000, 200)
@@ -10,6 +10,7 @@
 #if BOOST_OS_LINUX
 #include <sys/capability.h>
 #include <sys/syscall.h>
+#include <sched.h>
 #endif // BOOST_OS_LINUX
 
 #if BOOST_OS_UNIX
@@ -23,9 +24,57 @@
 namespace emilua {
 
 extern char inbox_key;
+extern char broadcast_key;
 
 void init_actor_module(lua_State* L);
 
+// Resumes the fiber blocked on `inbox:receive_many()` (if any) with the
+// messages queued up to the moment the posted wakeup runs. Wakeups requested
+// while one is already pending are coalesced.
+void schedule_batch_receive(const std::shared_ptr<vm_context>& vm_ctx);
+
+#if BOOST_OS_LINUX
+// Where to run the threads of an execution context.
+struct cpu_placement
+{
+    cpu_set_t cpus;
+
+    // -1 if the placement was given as an explicit list of CPUs
+    int numa_node = -1;
+
+    void apply_to_this_thread() const noexcept;
+};
+
+// Parses lists in the format used by cpuset(7) (e.g. "0-3,8,10-11").
+std::error_code parse_cpu_list(std::string_view list, cpu_set_t& out);
+
+// Fails if `cpus` contains CPUs the calling thread isn't allowed to run on
+// (offline CPUs or CPUs excluded by the affinity mask inherited from
+// taskset/cgroups).
+std::error_code check_allowed_cpus(const cpu_set_t& cpus);
+
+// Only the CPUs of the node the calling thread is allowed to run on are kept.
+std::error_code make_cpu_placement(int numa_node, cpu_placement& out);
+
+// While alive, memory for the calling thread is preferably allocated from the
+// given NUMA node.
+class scoped_preferred_numa_node
+{
+public:
+    explicit scoped_preferred_numa_node(int node) noexcept;
+    ~scoped_preferred_numa_node();
+
+    scoped_preferred_numa_node(const scoped_preferred_numa_node&) = delete;
+    scoped_preferred_numa_node& operator=(
+        const scoped_preferred_numa_node&) = delete;
+
+private:
+    bool active = false;
+    int old_mode;
+    unsigned long old_nodemask[16];
+};
+#endif // BOOST_OS_LINUX
+
 #if BOOST_OS_UNIX
 static constexpr std::uint64_t DOUBLE_SIGN_BIT = UINT64_C(0x8000000000000000);
 static constexpr std::uint64_t EXPONENT_MASK   = UINT64_C(0x7FF0000000000000);
@@ -45,7 +94,15 @@ struct ipc_actor_message
         string          = 3,
         file_descriptor = 4,
         actor_address   = 5,
-        nil             = 6
+        nil             = 6,
+
+        // Control message sent by spawn_vm() right after the subprocess is
+        // created. It carries the memfd and the private socket of an
+        // ipc_actor_ring and never reaches the user. Only the initial inbox
+        // socket of a subprocess accepts it (and only as its first datagram
+        // when the start message announced it). Anywhere else, it's a
+        // malformed message.
+        ring_setup      = 7
     };
 
     union {
@@ -61,6 +118,105 @@ struct ipc_actor_message
 };
 static_assert(EMILUA_CONFIG_IPC_ACTOR_MESSAGE_MAX_MEMBERS_NUMBER > 2);
 
+// Layout of the shared memory backing the optional ring transport of
+// ipc_actor channels (`subprocess.ring_size`). The data area holds records
+// (an ipc_actor_ring_record followed by the first `size` bytes of an
+// ipc_actor_message) padded to 8 bytes. A record of size `WRAP` tells the
+// consumer to resume at the start of the data area. `head` and `tail` are
+// free-running byte counters. Neither party trusts what the other one writes
+// (the consumer is usually a sandboxed process) so both keep private copies of
+// their own counters and validate the remote ones.
+//
+// The private socket of the ring carries no message bodies. The producer sends
+// file descriptors through it (before it publishes the record that refers to
+// them) and 1-byte wakeups when the consumer announced it's going to sleep. The
+// consumer sends 1-byte wakeups when the producer waits for room.
+struct ipc_actor_ring_header
+{
+    alignas(64) std::atomic<std::uint64_t> head;
+    alignas(64) std::atomic<std::uint64_t> tail;
+    alignas(64) std::atomic<std::uint32_t> consumer_sleeping;
+    std::atomic<std::uint32_t> producer_sleeping;
+};
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+struct ipc_actor_ring_record
+{
+    static constexpr std::uint32_t WRAP = UINT32_MAX;
+
+    std::uint32_t size;
+    std::uint32_t nfds;
+};
+
+class ipc_actor_ring
+{
+public:
+    enum class status
+    {
+        ok,
+        would_block,
+        bad
+    };
+
+    static constexpr std::size_t DATA_OFFSET = 4096;
+    static_assert(sizeof(ipc_actor_ring_header) <= DATA_OFFSET);
+
+    // The consumer maps whatever the producer asks for so the size is bounded
+    // to keep a misbehaving parent from exhausting the child's address space.
+    static constexpr std::uint64_t MAX_CAPACITY = UINT64_C(1) << 26;
+
+    static constexpr std::uint64_t record_length(std::uint32_t size)
+    {
+        return (sizeof(ipc_actor_ring_record) + size + 7) & ~UINT64_C(7);
+    }
+
+    // A power of two large enough to always fit one maximum-sized record
+    // after a wrap.
+    static constexpr bool valid_capacity(std::uint64_t capacity)
+    {
+        return (capacity & (capacity - 1)) == 0 &&
+            capacity >= 2 * record_length(sizeof(ipc_actor_message)) &&
+            capacity <= MAX_CAPACITY;
+    }
+
+    ipc_actor_ring() = default;
+    ~ipc_actor_ring();
+
+    ipc_actor_ring(const ipc_actor_ring&) = delete;
+    ipc_actor_ring& operator=(const ipc_actor_ring&) = delete;
+
+    // The memfd must be sealed against shrinking. Otherwise the remote party
+    // could turn our accesses into SIGBUS.
+    std::error_code map(int memfd);
+
+    // Producer side. commit() must only be called after reserve() returned
+    // `ok` for the same size.
+    status reserve(std::uint32_t size);
+    void commit(const void* data, std::uint32_t size, std::uint32_t nfds);
+    void prepare_producer_wait();
+    void wake_consumer(int sockfd);
+
+    // Consumer side.
+    status pop(ipc_actor_message& out, std::uint32_t& size,
+               std::uint32_t& nfds);
+    bool empty() const;
+    // Upper bound on the number of records published but not popped yet
+    // (pop() rejects records smaller than this estimate assumes).
+    std::uint64_t max_published_records() const;
+    // Returns false if new records were published in the meantime.
+    bool prepare_consumer_wait();
+    void wake_producer(int sockfd);
+
+private:
+    ipc_actor_ring_header* header = nullptr;
+    unsigned char* data = nullptr;
+    std::uint64_t capacity = 0;
+
+    // `tail` on the producer side, `head` on the consumer side
+    std::uint64_t pos = 0;
+};
+
 struct ipc_actor_inbox_service;
 
 struct ipc_actor_inbox_op
@@ -73,9 +229,15 @@ struct ipc_actor_inbox_op
     {}
 
     void do_wait();
+    void do_poll();
     void on_wait(const boost::system::error_code& ec);
 
 private:
+    void consume_ring(std::shared_ptr<vm_context>& vm_ctx);
+    void on_message(std::shared_ptr<vm_context>& vm_ctx,
+                    ipc_actor_message& message, ssize_t nread,
+                    std::vector<int>& fds);
+
     strand_type executor;
     std::weak_ptr<vm_context> vm_ctx;
     ipc_actor_inbox_service* service;
@@ -93,6 +255,22 @@ struct ipc_actor_inbox_service : public pending_operation
         assert(!ignored_ec);
     }
 
+    // `inboxfd` is the private socket of the ring
+    ipc_actor_inbox_service(asio::io_context& ioctx, int inboxfd,
+                            std::unique_ptr<ipc_actor_ring> ring)
+        : ipc_actor_inbox_service{ioctx, inboxfd}
+    {
+        this->ring = std::move(ring);
+    }
+
+    ~ipc_actor_inbox_service()
+    {
+        for (int fd: ring_fds) {
+            int res = close(fd);
+            boost::ignore_unused(res);
+        }
+    }
+
     void async_enqueue(vm_context& vm_ctx)
     {
         if (running)
@@ -100,7 +278,11 @@ struct ipc_actor_inbox_service : public pending_operation
 
         running = true;
         auto op = std::make_shared<ipc_actor_inbox_op>(vm_ctx, this);
-        op->do_wait();
+        // records might have been published without a wakeup
+        if (ring)
+            op->do_poll();
+        else
+            op->do_wait();
     }
 
     void cancel() noexcept override
@@ -108,6 +290,13 @@ struct ipc_actor_inbox_service : public pending_operation
 
     asio::local::seq_packet_protocol::socket sock;
     bool running = false;
+
+    // set by child_main() when the spawner announced a ring
+    bool expects_ring_setup = false;
+
+    std::unique_ptr<ipc_actor_ring> ring;
+    // descriptors received for records not yet popped
+    std::vector<int> ring_fds;
 };
 
 struct bzero_region
@@ -220,10 +409,16 @@ struct ipc_actor_address
 {
     ipc_actor_address(asio::io_context& ioctx)
         : dest{ioctx}
+        , ring_sock{ioctx}
     {}
 
     asio::local::seq_packet_protocol::socket dest;
     ipc_actor_reaper* reaper = nullptr;
+
+    // producer end of the ring negotiated by spawn_vm() (if any). Clones of
+    // this channel always use `dest`.
+    std::unique_ptr<ipc_actor_ring> ring;
+    asio::local::seq_packet_protocol::socket ring_sock;
 };
 #endif // BOOST_OS_UNIX
 
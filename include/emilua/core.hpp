@@ -39,14 +39,24 @@
 
 #include <condition_variable>
 #include <unordered_map>
+#include <algorithm>
 #include <shared_mutex>
 #include <system_error>
 #include <string_view>
 #include <filesystem>
 #include <optional>
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <variant>
 #include <atomic>
+#include <limits>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <array>
+#include <bit>
 #include <deque>
 #include <mutex>
 #include <map>
@@ -74,13 +84,24 @@ extern "C" {
 #define EMILUA_GPERF_DECLS_END(ID)
 #define EMILUA_GPERF_NAMESPACE(ID)
 
-#define EMILUA_IMPL_INITIAL_FIBER_DATA_CAPACITY 10
+#define EMILUA_IMPL_INITIAL_FIBER_DATA_CAPACITY 8
 #define EMILUA_IMPL_INITIAL_MODULE_FIBER_DATA_CAPACITY 5
+#define EMILUA_IMPL_FIBER_POOL_CAPACITY 64
+#define EMILUA_IMPL_PREEMPTION_CHECK_PERIOD 1000
+#define EMILUA_IMPL_PROFILER_MAX_DEPTH 100
+#define EMILUA_IMPL_ALLOCATOR_MAX_SMALL_SIZE 256
+#define EMILUA_IMPL_ALLOCATOR_ARENA_SIZE (64 * 1024)
+#define EMILUA_IMPL_WARM_VM_POOL_MAX_SIZE 1024
+#define EMILUA_IMPL_LOG_SINK_CAPACITY 1024
+#define EMILUA_IMPL_LOG_SINK_RECORD_SIZE 512
+#define EMILUA_IMPL_LOG_SINK_BATCH_SIZE 64
+#define EMILUA_IMPL_COARSE_TIMER_WHEEL_SLOTS 512
+#define EMILUA_IMPL_MESSAGE_INITIAL_CAPACITY 256
 
 // EMILUA_IMPL_INITIAL_MODULE_FIBER_DATA_CAPACITY currently takes into
 // consideration:
 //
-// * INTERRUPTION_DISABLED
+// * CONTROL_BLOCK
 // * JOINER
 // * STATUS
 // * MODULE_PATH
@@ -154,16 +175,12 @@ enum FiberDataIndex: lua_Integer
 {
     JOINER = 1,
     STATUS,
-    SUSPENSION_DISALLOWED,
     LOCAL_STORAGE,
     STACKTRACE,
 
     // data used by the interruption system {{{
-    INTERRUPTION_DISABLED,
-    INTERRUPTED,
     INTERRUPTER,
-    ASIO_CANCELLATION_SIGNAL,
-    DEFAULT_EMIT_SIGNAL_INTERRUPTER,
+    CONTROL_BLOCK, //< full userdata holding a fiber_control_block
     USER_HANDLE, //< "augmented joiner"
     // }}}
 
@@ -171,6 +188,49 @@ enum FiberDataIndex: lua_Integer
     MODULE_PATH
 };
 
+// Fiber state that is consulted on every suspension point lives here instead
+// of the fiber's data table. vm_context keeps a pointer to the control block of
+// the current fiber so these checks don't need any Lua table lookup.
+struct fiber_control_block
+{
+    bool interruption_disabled() const
+    {
+        return interruption_disabled_pinned || interruption_disabled_count > 0;
+    }
+
+    enum class interrupter_type: unsigned char
+    {
+        none,
+        // the function stored at FiberDataIndex::INTERRUPTER
+        lua,
+        // emit `cancellation_signal` (see set_default_interrupter())
+        default_signal,
+    };
+
+    asio::cancellation_signal cancellation_signal;
+    lua_Integer interruption_disabled_count = 0;
+    lua_Integer suspension_disallowed_count = 0;
+    interrupter_type interrupter = interrupter_type::none;
+
+    // modules' fibers and the async event thread are never interruptible and
+    // lua code requests to change this setting are ignored
+    bool interruption_disabled_pinned = false;
+
+    bool interrupted = false;
+
+    // only set for modules' fibers; the profiler uses it to attribute samples
+    // without touching the fiber's data table
+    std::string module_path;
+
+    // assigned by spawn(); unlike the lua_State (see recycle_fiber()), it's
+    // never reused within the VM
+    std::uint64_t id = 0;
+};
+
+// Uses `fiber`'s own stack to find its control block. Returns `nullptr` if
+// `fiber` isn't a fiber.
+fiber_control_block* get_fiber_control_block(lua_State* fiber);
+
 template<class T, class EC = std::error_code>
 using result = outcome::basic_result<
     T, EC,
@@ -336,6 +396,61 @@ struct rdf_error_category : public std::error_category
     > generic_errors;
 };
 
+// Hands log records over to a dedicated thread that writes them to stderr so a
+// slow reader on the other end doesn't stall the event loop. Producers never
+// block: records that don't fit in the ring are dropped and counted.
+class log_sink
+{
+public:
+    enum class format_type
+    {
+        text,
+        json
+    };
+
+    explicit log_sink(format_type format);
+    ~log_sink();
+
+    log_sink(const log_sink&) = delete;
+    log_sink& operator=(const log_sink&) = delete;
+
+    // Records longer than EMILUA_IMPL_LOG_SINK_RECORD_SIZE are cut
+    // blindly. app_context::vlog() truncates the message body beforehand so
+    // the record stays well-formed.
+    void push(std::string_view record) noexcept;
+
+    std::uint64_t dropped() const noexcept
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    const format_type format;
+
+private:
+    struct slot
+    {
+        std::atomic<std::size_t> sequence;
+        std::size_t size;
+        char data[EMILUA_IMPL_LOG_SINK_RECORD_SIZE];
+    };
+
+    bool is_ready(std::size_t pos) const noexcept
+    {
+        auto& s = slots_[pos % EMILUA_IMPL_LOG_SINK_CAPACITY];
+        return s.sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    void writer_main();
+
+    std::unique_ptr<slot[]> slots_;
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::uint32_t> wakeups_{0};
+    std::atomic<bool> writer_idle_{false};
+    std::atomic<bool> stop_{false};
+    std::thread writer_;
+};
+
 class app_context
 {
 private:
@@ -371,6 +486,9 @@ public:
     static int ipc_actor_service_main(int sockfd);
 #endif // BOOST_OS_UNIX
 
+    // Reads EMILUA_LOG_SINK from app_env
+    void init_log_sink();
+
     std::vector<std::string_view> app_args;
     std::unordered_map<std::string_view, std::string_view> app_env;
     int exit_code = 0;
@@ -379,6 +497,11 @@ public:
 
     std::vector<std::filesystem::path> emilua_path;
 
+    // Directory that holds the bytecode for modules compiled by previous runs
+    // (EMILUA_BYTECODE_CACHE). Empty means disabled.
+    std::filesystem::path bytecode_cache_dir;
+
+    // Maps module paths to their bytecode (or source when they don't compile)
     std::unordered_map<std::filesystem::path, std::string, path_hash>
         modules_cache_registry;
     std::unordered_map<
@@ -399,6 +522,19 @@ public:
     // <https://lists.isocpp.org/std-proposals/2021/07/2809.php>.
     std::condition_variable extra_threads_count_dummy_cond;
 
+    // Thread pool shared among every VM spawned with `shared_context=true`
+    // (M:N scheduling). It's created on demand and its threads exit once the
+    // last VM hosted there is gone.
+    std::weak_ptr<asio::executor_work_guard<asio::io_context::executor_type>>
+        shared_context_work_guard;
+    std::mutex shared_context_mtx;
+
+    // 0 means std::thread::hardware_concurrency()
+    unsigned shared_context_nthreads = 0;
+
+    // Empty means log records are written synchronously by the calling thread
+    std::unique_ptr<log_sink> async_log_sink;
+
 #if BOOST_OS_UNIX
     int ipc_actor_service_sockfd = -1;
     static char*** environp;
@@ -483,29 +619,189 @@ struct inbox_t
     };
 #endif // BOOST_OS_UNIX
 
-    struct value_type: std::variant<
-        bool, lua_Number, std::string,
+    // A byte_span's buffer is moved into the message when the sender held the
+    // only reference to it (see `make_byte_span_value()`). Otherwise, it's a
+    // private copy. Either way, nothing else references it.
+    struct byte_span_value
+    {
+        std::shared_ptr<unsigned char[]> data;
+        lua_Integer size;
+        lua_Integer capacity;
+    };
+
+    // A message is a tree stored in pre-order within a single contiguous
+    // buffer. Every node is a `header` (aligned to `alignof(header)`) followed
+    // by its key (object members only) and, for strings, its bytes. Container
+    // nodes are followed by their children and record the offset one past
+    // their last descendant so readers can skip whole subtrees. Values that
+    // own resources (actor addresses, file descriptors, ...) live in a side
+    // vector that is only allocated when the message carries any of them.
+    //
+    // Nodes are referred to by their offset within the buffer. The root node
+    // sits at offset 0.
+    class message
+    {
+    public:
+        enum class kind : std::uint8_t
+        {
+            boolean,
+            number,
+            string,
+            object,
+            array,
+            handle
+        };
+
+        using handle_type = std::variant<
+            actor_address,
 #if BOOST_OS_UNIX
-        std::shared_ptr<file_descriptor_box>,
-        ipc_actor_address,
+            std::shared_ptr<file_descriptor_box>,
+            ipc_actor_address,
 #endif // BOOST_OS_UNIX
-        std::map<std::string, value_type>,
-        std::vector<value_type>,
-        actor_address
-    >
-    {
-        using variant_type = variant;
+            byte_span_value
+        >;
+
+        struct header
+        {
+            kind type;
+            std::size_t key_size;
+
+            // * boolean: 0 or 1
+            // * string: number of bytes
+            // * object/array: number of children
+            // * handle: index into the handles vector
+            std::size_t size;
+
+            union
+            {
+                lua_Number number;
+
+                // object/array only: offset one past the subtree. While the
+                // container is being built, it stores the offset of the
+                // enclosing open container plus one (0 for none)
+                std::size_t end;
+            };
+        };
 
-        using variant::variant;
+        message() = default;
 
-        value_type(value_type&&) = default;
-        value_type(const value_type&) = default;
+        message(message&& o)
+            : buffer_{std::move(o.buffer_)}
+            , size_{std::exchange(o.size_, 0)}
+            , capacity_{std::exchange(o.capacity_, 0)}
+            , open_{std::exchange(o.open_, 0)}
+            , handles_{std::move(o.handles_)}
+        {}
 
-        value_type& operator=(value_type&&) = default;
-    };
+        message& operator=(message&& o)
+        {
+            buffer_ = std::move(o.buffer_);
+            size_ = std::exchange(o.size_, 0);
+            capacity_ = std::exchange(o.capacity_, 0);
+            open_ = std::exchange(o.open_, 0);
+            handles_ = std::move(o.handles_);
+            return *this;
+        }
+
+        message(const message&) = delete;
+        message& operator=(const message&) = delete;
+
+        // Builder interface. Nodes must be appended in pre-order. `key` is
+        // ignored for the root node and array elements.
+        void add_boolean(std::string_view key, bool value);
+        void add_number(std::string_view key, lua_Number value);
+        void add_string(std::string_view key, std::string_view value);
+        void add_handle(std::string_view key, handle_type value);
+        void begin_object(std::string_view key);
+        void begin_array(std::string_view key);
+        void end_container();
+
+        // Offset the next appended node will take.
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        // Reader interface.
+        const header& at(std::size_t offset) const
+        {
+            return *reinterpret_cast<const header*>(buffer_.get() + offset);
+        }
+
+        std::string_view key(std::size_t offset) const
+        {
+            return {
+                reinterpret_cast<const char*>(
+                    buffer_.get() + offset + sizeof(header)),
+                at(offset).key_size
+            };
+        }
+
+        std::string_view string(std::size_t offset) const
+        {
+            auto& h = at(offset);
+            return {
+                reinterpret_cast<const char*>(
+                    buffer_.get() + offset + sizeof(header) + h.key_size),
+                h.size
+            };
+        }
+
+        handle_type& handle(std::size_t offset)
+        {
+            return handles_[at(offset).size];
+        }
+
+        const handle_type& handle(std::size_t offset) const
+        {
+            return handles_[at(offset).size];
+        }
+
+        // For containers, it's the offset of their first child (or `end` if
+        // empty).
+        std::size_t first_child(std::size_t offset) const
+        {
+            return offset + record_size(at(offset).key_size, 0);
+        }
+
+        // Offset of the next sibling (i.e. skips the whole subtree).
+        std::size_t next(std::size_t offset) const
+        {
+            auto& h = at(offset);
+            switch (h.type) {
+            case kind::object:
+            case kind::array:
+                return h.end;
+            case kind::string:
+                return offset + record_size(h.key_size, h.size);
+            default:
+                return offset + record_size(h.key_size, 0);
+            }
+        }
 
-    using value_object_type = std::map<std::string, value_type>;
-    using value_array_type = std::vector<value_type>;
+    private:
+        static std::size_t record_size(std::size_t key_size,
+                                       std::size_t payload_size)
+        {
+            constexpr std::size_t align = alignof(header);
+            return (sizeof(header) + key_size + payload_size + align - 1) /
+                align * align;
+        }
+
+        header& append(kind type, std::string_view key,
+                       std::string_view payload = {});
+
+        std::unique_ptr<unsigned char[]> buffer_;
+        std::size_t size_ = 0;
+        std::size_t capacity_ = 0;
+        std::size_t open_ = 0;
+        std::vector<handle_type> handles_;
+    };
 
     struct sender_state
     {
@@ -531,12 +827,120 @@ struct inbox_t
         std::shared_ptr<vm_context> vm_ctx;
         asio::executor_work_guard<asio::io_context::executor_type> work_guard;
         lua_State* fiber;
-        value_type msg;
+        message msg;
+
+        // Broadcasts share one immutable message among all subscribers
+        // (`msg` is left empty). `lag` counts the broadcast messages that
+        // didn't leave the subscriber's inbox yet.
+        std::shared_ptr<const message> shared_msg;
+        std::shared_ptr<std::atomic_size_t> lag;
+
         bool wake_on_destruct = false;
     };
 
+    // Messages sent by in-process actors don't go through the strand queue
+    // one by one. Senders (running on any thread) push them into a lock-free
+    // list instead and only the push that rings `doorbell` posts a task to
+    // deliver them. Every message that arrives before that task runs gets
+    // delivered by it (a single wakeup).
+    struct delivery
+    {
+        delivery(sender_state&& sender)
+            : sender{std::move(sender)}
+        {}
+
+        sender_state sender;
+        delivery* next = nullptr;
+    };
+
+    inbox_t() = default;
+    inbox_t(const inbox_t&) = delete;
+    inbox_t& operator=(const inbox_t&) = delete;
+
+    ~inbox_t()
+    {
+        auto d = deliveries.exchange(nullptr);
+        while (d) {
+            auto next = d->next;
+            delete d;
+            d = next;
+        }
+    }
+
+    // Returns whether the caller rang the doorbell (and must then schedule
+    // a call to `take_deliveries()`).
+    bool push(delivery* d)
+    {
+        d->next = deliveries.load(std::memory_order_relaxed);
+        while (!deliveries.compare_exchange_weak(d->next, d));
+        return !doorbell.exchange(true);
+    }
+
+    // Takes every pending delivery (oldest first). Must only be called from
+    // the inbox's strand.
+    delivery* take_deliveries()
+    {
+        // The doorbell is reset before the list is taken so a push that
+        // misses this call is guaranteed to ring it again.
+        doorbell.store(false);
+        delivery* lifo = deliveries.exchange(nullptr);
+        delivery* fifo = nullptr;
+        while (lifo) {
+            auto next = lifo->next;
+            lifo->next = fifo;
+            fifo = lifo;
+            lifo = next;
+        }
+        return fifo;
+    }
+
+    std::atomic<delivery*> deliveries = nullptr;
+    std::atomic_bool doorbell = false;
+
     lua_State* recv_fiber = nullptr;
+
+    // Non-zero while `recv_fiber` waits on `receive_many()`. Deliveries are
+    // queued into `incoming` instead and a single wakeup (tracked by
+    // `batch_wakeup_pending`) hands the receiver everything that piled up in
+    // the meantime.
+    std::size_t recv_max = 0;
+    bool batch_wakeup_pending = false;
+
+    // What to do with a message that arrives when `incoming` already holds
+    // `capacity` messages.
+    enum class overflow_policy : std::uint8_t
+    {
+        block,
+        fail,
+        drop_oldest,
+        drop_newest
+    };
+
+    // Moves senders from `blocked` into `incoming` while there's room and
+    // publishes the new queue depth. Must be called after every change to
+    // either queue.
+    void refill()
+    {
+        auto max = capacity.load(std::memory_order_relaxed);
+        while (blocked.size() != 0 && incoming.size() < max) {
+            incoming.emplace_back(std::move(blocked.front()));
+            blocked.pop_front();
+        }
+        depth.store(incoming.size(), std::memory_order_relaxed);
+    }
+
     std::deque<sender_state> incoming;
+
+    // Senders waiting for room in a full inbox (`overflow_policy::block`).
+    std::deque<sender_state> blocked;
+
+    // Only changed from the inbox's strand, but senders running on other
+    // threads also read them (`try_send()`).
+    std::atomic_size_t capacity = std::numeric_limits<std::size_t>::max();
+    std::atomic<overflow_policy> policy = overflow_policy::block;
+    std::atomic_size_t depth = 0;
+    std::atomic_uint64_t dropped = 0;
+
     bool open = true;
     bool imported = false;
     std::atomic_size_t nsenders = 0;
@@ -571,6 +975,122 @@ public:
     bool shared_ownership;
 };
 
+// Scheduling counters for a single VM. Every member is only touched from
+// within the VM's strand.
+struct vm_stats
+{
+    // Bucket `i` counts samples whose duration (in nanoseconds) lies in
+    // `[2^i, 2^(i+1))`. Bucket 0 also counts zero-length samples and the last
+    // bucket also counts every sample that overflows the histogram.
+    using histogram_type = std::array<std::uint64_t, 32>;
+
+    static void record(histogram_type& h, std::chrono::nanoseconds d)
+    {
+        auto ns = static_cast<std::uint64_t>(
+            std::max<std::chrono::nanoseconds::rep>(d.count(), 1));
+        std::size_t idx = std::bit_width(ns) - 1;
+        ++h[std::min(idx, h.size() - 1)];
+    }
+
+    // Number of times control entered the Lua VM (lua_resume() calls).
+    std::uint64_t resumes = 0;
+
+    // Time spent inside lua_resume().
+    std::chrono::nanoseconds run_time{0};
+    histogram_type run_time_histogram = {};
+
+    // Time elapsed between a wake-up being scheduled on the strand and the
+    // fiber actually running. Only wake-ups that carry
+    // `vm_context::options::enqueued_at` are sampled.
+    std::uint64_t queue_delay_samples = 0;
+    std::chrono::nanoseconds queue_delay{0};
+    histogram_type queue_delay_histogram = {};
+
+    // Number of times a fiber was suspended because it exhausted its
+    // preemption budget (see `vm_context::set_preemption_budget()`).
+    std::uint64_t preemptions = 0;
+
+    // Filled on demand by `vm_context::stats()`.
+    std::size_t live_fibers = 0;
+    std::size_t heap_size = 0;
+    std::size_t peak_heap_size = 0;
+    std::uint64_t allocations = 0;
+};
+
+// Backs the Lua heap of a single VM. Small blocks (the bulk of a Lua heap:
+// table headers, short strings, closures, userdata...) are served from
+// per-size-class free lists carved out of arenas that are only released when
+// the allocator is destroyed. Bigger blocks go straight to malloc(). It also
+// tracks the heap size and enforces an optional hard limit.
+//
+// LuaJIT builds that can't use custom allocators (x64 without GC64) keep the
+// builtin allocator and only get the counters and the limit.
+class vm_allocator
+{
+public:
+    static constexpr std::size_t granularity = alignof(std::max_align_t);
+    static constexpr std::size_t nsize_classes =
+        EMILUA_IMPL_ALLOCATOR_MAX_SMALL_SIZE / granularity;
+
+    vm_allocator() = default;
+    vm_allocator(const vm_allocator&) = delete;
+    vm_allocator& operator=(const vm_allocator&) = delete;
+    ~vm_allocator();
+
+    // `f(ud, ...)` must forward to reallocate()
+    lua_State* new_state(lua_Alloc f, void* ud);
+
+    // Same contract as lua_Alloc. Growing the heap beyond `limit` fails.
+    void* reallocate(void* ptr, std::size_t osize, std::size_t nsize);
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    std::size_t peak_size() const
+    {
+        return peak_size_;
+    }
+
+    // Number of blocks allocated so far (reallocations of live blocks don't
+    // count).
+    std::uint64_t allocations() const
+    {
+        return allocations_;
+    }
+
+    // 0 means no limit
+    std::size_t limit = 0;
+
+private:
+    struct free_block
+    {
+        free_block* next;
+    };
+
+    static std::size_t size_class(std::size_t size)
+    {
+        return (std::max<std::size_t>(size, 1) - 1) / granularity;
+    }
+
+    void* pooled_reallocate(void* ptr, std::size_t osize, std::size_t nsize);
+    void* allocate(std::size_t size);
+    void deallocate(void* ptr, std::size_t size);
+
+    std::array<free_block*, nsize_classes> free_lists_ = {};
+    std::vector<void*> arenas_;
+    char* arena_next_ = nullptr;
+    char* arena_end_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t peak_size_ = 0;
+    std::uint64_t allocations_ = 0;
+
+    // only set when wrapping LuaJIT's builtin allocator
+    lua_Alloc upstream_ = nullptr;
+    void* upstream_ud_ = nullptr;
+};
+
 class vm_context: public std::enable_shared_from_this<vm_context>
 {
 public:
@@ -588,8 +1108,8 @@ public:
         static constexpr struct variadic_arguments_t {} variadic_arguments{};
 
         // Convert from `asio::error::operation_aborted` to `errc::interrupted`
-        // iff `FiberDataIndex::INTERRUPTED` has been set for the fiber about to
-        // be resumed.
+        // iff `fiber_control_block::interrupted` has been set for the fiber
+        // about to be resumed.
         //
         // If the implementation for your IO operation has the following
         // workflow:
@@ -625,6 +1145,11 @@ public:
         // no way for user-written Lua code to call io_object.cancel()).
         static constexpr
         struct fast_auto_detect_interrupt_t {} fast_auto_detect_interrupt{};
+
+        // Use it as the first member of a pair whose second member is the
+        // `std::chrono::steady_clock::time_point` when the wake-up was
+        // scheduled. The elapsed time feeds the VM's queue delay stats.
+        static constexpr struct enqueued_at_t {} enqueued_at{};
     };
 
     vm_context(app_context& appctx, strand_type strand);
@@ -665,6 +1190,7 @@ public:
     lua_State* async_event_thread()
     {
         current_fiber_ = async_event_thread_;
+        current_fiber_control_block_ = async_event_thread_control_block_;
         return async_event_thread_;
     }
 
@@ -675,6 +1201,12 @@ public:
         return current_fiber_;
     }
 
+    fiber_control_block& current_fiber_control_block()
+    {
+        assert(current_fiber_control_block_);
+        return *current_fiber_control_block_;
+    }
+
     bool valid()
     {
         return valid_;
@@ -690,9 +1222,59 @@ public:
     template<class HanaSet = std::decay_t<decltype(hana::make_set())>>
     void fiber_resume(lua_State* new_current_fiber, HanaSet&& options = {});
 
+    // Schedules `fiber` to be resumed with no arguments. Fibers scheduled
+    // before the strand gets to run them share a single posted handler which
+    // resumes them in FIFO order (e.g. every waiter woken by a notify_all()
+    // storm). Must be called from within the VM's strand.
+    void enqueue_ready_fiber(lua_State* fiber, bool skip_clear_interrupter,
+                             std::chrono::steady_clock::time_point enqueued_at);
+
     void notify_errmem();
     void notify_exit_request();
 
+    // Must be called from within the VM's strand.
+    vm_stats stats();
+
+    // Opt-in cooperative preemption. A fiber that runs for more than
+    // `instructions` VM instructions (or longer than `time_slice`, when
+    // non-zero) without suspending is yielded back to the scheduler just like
+    // `this_fiber.yield()` would do. A zero `instructions` checks the time
+    // slice every EMILUA_IMPL_PREEMPTION_CHECK_PERIOD instructions. The JIT
+    // compiler is turned off for the VM as compiled traces never check the
+    // budget. Must be called before the VM starts running.
+    void set_preemption_budget(int instructions,
+                               std::chrono::nanoseconds time_slice);
+
+    // Called from the preemption hook. If `L` is the current fiber, its
+    // budget is exhausted and it may suspend, schedules its resumption and
+    // returns true.
+    bool consume_preemption_budget(lua_State* L);
+
+    // Hard limit (in bytes) for the Lua heap. An allocation that would grow
+    // the heap beyond it fails and the VM is closed just like on any other
+    // LUA_ERRMEM. 0 disables the limit. A limit below the current heap size
+    // only affects future allocations.
+    void set_memory_limit(std::size_t bytes)
+    {
+        allocator_.limit = bytes;
+    }
+
+    // Sampling profiler built on top of LuaJIT's profiler. Every `interval`
+    // the running stack is sampled and aggregated as a folded stack whose
+    // root frame names the module (for modules' fibers) or the fiber where
+    // the sample was taken. Previous samples are discarded. LuaJIT only
+    // supports one profiled VM per process at a time. Must be called from
+    // within the VM's strand.
+    std::error_code start_profiler(std::chrono::milliseconds interval);
+    void stop_profiler();
+
+    // Samples gathered so far in the folded stacks format consumed by
+    // flamegraph.pl (one `frame;frame;frame count` line per unique stack).
+    std::string profile() const;
+
+    // Called from the profiler callback.
+    void record_profile_sample(lua_State* L, int samples, int vmstate);
+
     void notify_deadlock(std::string msg);
     void notify_cleanup_error(lua_State* coro);
 
@@ -705,6 +1287,9 @@ public:
     {
         assert(async_event_thread_ == nullptr);
         async_event_thread_ = new_async_event_thread;
+        async_event_thread_control_block_ =
+            get_fiber_control_block(new_async_event_thread);
+        assert(async_event_thread_control_block_);
     }
 
     lua_State* async_event_thread_
@@ -736,18 +1321,80 @@ public:
     // can be empty
     std::weak_ptr<asio::io_context> ioctxref;
 
+    // can be empty; only set for VMs hosted on the shared context
+    std::shared_ptr<asio::executor_work_guard<asio::io_context::executor_type>>
+        shared_context_work_guard;
+
+    // number of finished fibers parked in the pool that spawn() draws from
+    // (see recycle_fiber())
+    int fiber_pool_size = 0;
+
+    // last id given to a fiber (see fiber_control_block::id)
+    std::uint64_t last_fiber_id = 0;
+
+    // VMs created in advance for spawn_vm{warm_pool=...}. They're already
+    // bound to their entry point, but haven't been started yet.
+    struct warm_vm_pool
+    {
+        std::filesystem::path module_path;
+        std::filesystem::path import_root;
+        std::size_t size;
+        std::size_t pending_refills = 0;
+        std::vector<std::shared_ptr<vm_context>> vms;
+    };
+    std::vector<warm_vm_pool> warm_vm_pools;
+
 private:
+    struct ready_fiber
+    {
+        lua_State* fiber;
+        std::chrono::steady_clock::time_point enqueued_at;
+        bool skip_clear_interrupter;
+    };
+
+    static void* lua_alloc(void* ud, void* ptr, std::size_t osize,
+                           std::size_t nsize);
+
     void fiber_epilogue(int resume_result);
+    void drain_ready_queue();
+
+    int timed_resume(lua_State* fiber, int narg)
+    {
+        auto start = std::chrono::steady_clock::now();
+        resume_started_at_ = start;
+        int res = lua_resume(fiber, narg);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        ++stats_.resumes;
+        stats_.run_time += elapsed;
+        vm_stats::record(stats_.run_time_histogram, elapsed);
+        return res;
+    }
 
     strand_type strand_;
     bool valid_;
     bool lua_errmem;
     bool exit_request;
     bool suppress_tail_errors = false;
+
+    // must outlive `L_`
+    vm_allocator allocator_;
     lua_State* L_;
     lua_State* current_fiber_;
+    fiber_control_block* current_fiber_control_block_ = nullptr;
+    fiber_control_block* async_event_thread_control_block_ = nullptr;
     std::vector<std::string> deadlock_errors;
     void* failed_cleanup_handler_coro = nullptr;
+    vm_stats stats_;
+    std::chrono::steady_clock::time_point resume_started_at_;
+    std::chrono::nanoseconds preemption_time_slice_{0};
+    bool profiling_ = false;
+
+    // A drain handler is pending on the strand iff `ready_queue_` isn't empty.
+    // `ready_batch_` only holds the fibers being resumed by the drain handler
+    // (kept as a member to reuse its capacity).
+    std::vector<ready_fiber> ready_queue_;
+    std::vector<ready_fiber> ready_batch_;
+    std::unordered_map<std::string, std::uint64_t> profile_samples_;
 };
 
 vm_context& get_vm_context(lua_State* L);
@@ -946,6 +1593,7 @@ public:
 namespace detail {
 bool unsafe_can_suspend(vm_context& vm_ctx, lua_State* L);
 bool unsafe_can_suspend2(vm_context& vm_ctx, lua_State* L);
+void preemption_hook(lua_State* L, lua_Debug* ar);
 } // namespace detail
 
 } // namespace emilua
@@ -990,6 +1638,16 @@ void vm_context::fiber_resume(lua_State* new_current_fiber, HanaSet&& options)
             hana::always(hana::false_c)
         )(x);
     };
+    static constexpr auto is_enqueued_at = [](auto&& x) {
+        return hana::if_(
+            hana::is_a<hana::pair_tag>(x),
+            [](auto&& x) {
+                return hana::typeid_(hana::first(x)) ==
+                    hana::type_c<options::enqueued_at_t>;
+            },
+            hana::always(hana::false_c)
+        )(x);
+    };
 
     static constexpr decltype(hana::any_of(options, is_skip_clear_interrupter))
         has_skip_clear_interrupter;
@@ -1008,6 +1666,16 @@ void vm_context::fiber_resume(lua_State* new_current_fiber, HanaSet&& options)
     assert(lua_status(new_current_fiber) == 0 ||
            lua_status(new_current_fiber) == LUA_YIELD);
     current_fiber_ = new_current_fiber;
+    current_fiber_control_block_ = get_fiber_control_block(new_current_fiber);
+    assert(current_fiber_control_block_);
+
+    hana::find_if(options, is_enqueued_at) | [&](auto&& x) {
+        auto elapsed = std::chrono::steady_clock::now() - hana::second(x);
+        ++stats_.queue_delay_samples;
+        stats_.queue_delay += elapsed;
+        vm_stats::record(stats_.queue_delay_histogram, elapsed);
+        return hana::nothing;
+    };
 
     int narg = 0;
 
@@ -1026,18 +1694,9 @@ void vm_context::fiber_resume(lua_State* new_current_fiber, HanaSet&& options)
                         // until the next interruption/suspendion point anyway).
                         if (ec == asio::error::operation_aborted) {
                             // A call to `fib:interrupt()` will set
-                            // `FiberDataIndex::INTERRUPTED` for `fib`
+                            // `fiber_control_block::interrupted` for `fib`
                             // automatically.
-                            rawgetp(new_current_fiber, LUA_REGISTRYINDEX,
-                                    &fiber_list_key);
-                            lua_pushthread(new_current_fiber);
-                            lua_rawget(new_current_fiber, -2);
-                            lua_rawgeti(new_current_fiber, -1,
-                                        FiberDataIndex::INTERRUPTED);
-                            bool interrupted =
-                                lua_toboolean(new_current_fiber, -1);
-                            lua_pop(new_current_fiber, 3);
-                            if (interrupted)
+                            if (current_fiber_control_block_->interrupted)
                                 std_ec = errc::interrupted;
                         }
                     } else if (has_fast_auto_detect_interrupt) {
@@ -1106,10 +1765,14 @@ void vm_context::fiber_resume(lua_State* new_current_fiber, HanaSet&& options)
         set_interrupter(new_current_fiber, *this);
     }
 
-    int res = lua_resume(new_current_fiber, narg);
+    int res = timed_resume(new_current_fiber, narg);
     fiber_epilogue(res);
 }
 
+// Delivers everything pushed into the inbox's lock-free list so far (in
+// arrival order). Runs on the inbox's strand.
+void drain_deliveries(const std::shared_ptr<vm_context>& vm_ctx);
+
 inline actor_address::actor_address(vm_context& vm_ctx)
     : dest{vm_ctx.weak_from_this()}
     , work_guard{vm_ctx.work_guard()}
@@ -1147,6 +1810,10 @@ inline actor_address::~actor_address()
         return;
 
     vm_ctx->strand().post([vm_ctx]() {
+        // a message sent right before the last handle was dropped may still
+        // be in the lock-free list and must win over `no_senders`
+        drain_deliveries(vm_ctx);
+
         if (vm_ctx->inbox.nsenders.load() != 0) {
             // another fiber from the actor already created a new sender
             return;
@@ -1171,14 +1838,12 @@ inline inbox_t::sender_state::sender_state(vm_context& vm_ctx)
     : vm_ctx(vm_ctx.shared_from_this())
     , work_guard(vm_ctx.work_guard())
     , fiber(vm_ctx.current_fiber())
-    , msg{std::in_place_type<bool>, false}
 {}
 
 inline inbox_t::sender_state::sender_state(vm_context& vm_ctx, lua_State* fiber)
     : vm_ctx(vm_ctx.shared_from_this())
     , work_guard(vm_ctx.work_guard())
     , fiber(fiber)
-    , msg{std::in_place_type<bool>, false}
 {}
 
 inline inbox_t::sender_state::sender_state(std::nullopt_t)
@@ -1190,7 +1855,6 @@ inline inbox_t::sender_state::sender_state(std::nullopt_t)
         return work_guard;
     }()}
     , fiber{nullptr}
-    , msg{std::in_place_type<bool>, false}
     , wake_on_destruct{false}
 {}
 
@@ -1199,6 +1863,8 @@ inline inbox_t::sender_state::sender_state(sender_state&& o)
     , work_guard(std::move(o.work_guard))
     , fiber(o.fiber)
     , msg(std::move(o.msg))
+    , shared_msg(std::move(o.shared_msg))
+    , lag(std::move(o.lag))
     , wake_on_destruct(o.wake_on_destruct)
 {
     o.wake_on_destruct = false;
@@ -1206,7 +1872,10 @@ inline inbox_t::sender_state::sender_state(sender_state&& o)
 
 inline inbox_t::sender_state::~sender_state()
 {
-    if (!wake_on_destruct)
+    if (lag)
+        --*lag;
+
+    if (!wake_on_destruct || !vm_ctx)
         return;
 
     vm_ctx->strand().post([vm_ctx=vm_ctx, fiber=fiber]() {
@@ -1223,7 +1892,7 @@ inline
 inbox_t::sender_state&
 inbox_t::sender_state::operator=(inbox_t::sender_state&& o)
 {
-    if (wake_on_destruct) {
+    if (wake_on_destruct && vm_ctx) {
         vm_ctx->strand().post([vm_ctx=vm_ctx, fiber=fiber]() {
             auto opt_args = vm_context::options::arguments;
             vm_ctx->fiber_resume(
@@ -1240,6 +1909,10 @@ inbox_t::sender_state::operator=(inbox_t::sender_state&& o)
         asio::io_context::executor_type>{std::move(o.work_guard)};
     fiber = o.fiber;
     msg = std::move(o.msg);
+    shared_msg = std::move(o.shared_msg);
+    if (lag)
+        --*lag;
+    lag = std::move(o.lag);
     wake_on_destruct = o.wake_on_destruct;
 
     o.wake_on_destruct = false;
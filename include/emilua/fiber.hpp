@@ -36,4 +36,15 @@ void print_panic(const lua_State* L, bool is_main, std::string_view error,
 
 int set_current_traceback(lua_State* L);
 
+// Pushes a new full userdata holding a default-constructed control block.
+fiber_control_block& new_fiber_control_block(lua_State* L);
+
+// Parks `fiber` in the VM's fiber pool so a later spawn() may reuse its
+// coroutine, data table and control block. `fiber` must have finished
+// successfully and its fiber_list entry must be gone already. `data_idx` is
+// the index of the fiber's data table on `L`'s stack (`L` may be `fiber`
+// itself). `fiber`'s stack is always cleared.
+void recycle_fiber(vm_context& vm_ctx, lua_State* L, int data_idx,
+                   lua_State* fiber);
+
 } // namespace emilua
@@ -98,14 +98,11 @@ static int cond_wait(lua_State* L)
     if (mutex_handle->pending.size() == 0) {
         mutex_handle->locked = false;
     } else {
-        auto vm_ctx = mutex_handle->vm_ctx.shared_from_this();
         auto next = mutex_handle->pending.front();
         mutex_handle->pending.pop_front();
-        vm_ctx->strand().post([vm_ctx,next]() {
-            vm_ctx->fiber_resume(
-                next,
-                hana::make_set(vm_context::options::skip_clear_interrupter));
-        }, std::allocator<void>{});
+        mutex_handle->vm_ctx.enqueue_ready_fiber(
+            next, /*skip_clear_interrupter=*/true,
+            std::chrono::steady_clock::now());
     }
     // }}}
 
@@ -130,12 +127,11 @@ static int cond_notify_one(lua_State* L)
     if (handle->pending.size() == 0)
         return 0;
 
-    auto vm_ctx = get_vm_context(L).shared_from_this();
     auto next = handle->pending.front();
     handle->pending.pop_front();
-    vm_ctx->strand().post([vm_ctx,next]() {
-        vm_ctx->fiber_resume(next);
-    }, std::allocator<void>{});
+    get_vm_context(L).enqueue_ready_fiber(
+        next, /*skip_clear_interrupter=*/false,
+        std::chrono::steady_clock::now());
     return 0;
 }
 
@@ -152,11 +148,11 @@ static int cond_notify_all(lua_State* L)
         return lua_error(L);
     }
 
-    auto vm_ctx = get_vm_context(L).shared_from_this();
+    auto& vm_ctx = get_vm_context(L);
+    auto enqueued_at = std::chrono::steady_clock::now();
     for (auto& p: handle->pending) {
-        vm_ctx->strand().post([vm_ctx,p]() {
-            vm_ctx->fiber_resume(p);
-        }, std::allocator<void>{});
+        vm_ctx.enqueue_ready_fiber(
+            p, /*skip_clear_interrupter=*/false, enqueued_at);
     }
     handle->pending.clear();
     return 0;
@@ -3,7 +3,11 @@
    Distributed under the Boost Software License, Version 1.0. (See accompanying
    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt) */
 
+#include <algorithm>
 #include <charconv>
+#include <cstring>
+#include <cstdlib>
+#include <iterator>
 #include <locale>
 #include <new>
 
@@ -19,6 +23,11 @@
 #include <emilua/fiber.hpp>
 #include <emilua/actor.hpp>
 
+#if BOOST_OS_UNIX
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // BOOST_OS_UNIX
+
 namespace emilua {
 
 bool stdout_has_color;
@@ -136,11 +145,326 @@ void app_context::init_log_domain(std::string_view name, int& log_level)
     log_level = level;
 }
 
+// Cuts str to at most n bytes without splitting an UTF-8 sequence
+static std::string_view utf8_prefix(std::string_view str, std::size_t n)
+{
+    if (n >= str.size())
+        return str;
+
+    while (n > 0 && (static_cast<unsigned char>(str[n]) & 0xC0) == 0x80)
+        --n;
+    return str.substr(0, n);
+}
+
+static std::size_t json_escaped_size(char c)
+{
+    switch (c) {
+    case '"':
+    case '\\':
+    case '\n':
+        return 2;
+    default:
+        return (static_cast<unsigned char>(c) < 0x20) ? 6 : 1;
+    }
+}
+
+// Longest prefix of str whose escaped form fits in max_size bytes
+static std::string_view json_escaped_prefix(std::string_view str,
+                                            std::size_t max_size)
+{
+    std::size_t n = 0;
+    for (std::size_t escaped_size = 0 ; n != str.size() ; ++n) {
+        escaped_size += json_escaped_size(str[n]);
+        if (escaped_size > max_size)
+            break;
+    }
+    return utf8_prefix(str, n);
+}
+
+static void append_json_string(fmt::memory_buffer& buf, std::string_view str)
+{
+    auto out = fmt::appender(buf);
+    *out++ = '"';
+    for (char c: str) {
+        switch (c) {
+        case '"':
+            fmt::format_to(out, FMT_STRING("\\\""));
+            break;
+        case '\\':
+            fmt::format_to(out, FMT_STRING("\\\\"));
+            break;
+        case '\n':
+            fmt::format_to(out, FMT_STRING("\\n"));
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                fmt::format_to(
+                    out, FMT_STRING("\\u{:04x}"),
+                    static_cast<unsigned char>(c));
+            } else {
+                *out++ = c;
+            }
+        }
+    }
+    *out++ = '"';
+}
+
+// The message is truncated (never the JSON syntax around it) so the record
+// fits in a log_sink slot
+static void format_json_record(
+    fmt::memory_buffer& buf, int priority, std::string_view domain,
+    std::string_view message)
+{
+    // domains are module names, but nothing stops the user from passing a
+    // longer one and it must leave room for the message
+    constexpr std::size_t max_domain_size = 64;
+
+    auto out = fmt::appender(buf);
+    fmt::format_to(out, FMT_STRING("{{\"priority\":{},\"domain\":"), priority);
+    append_json_string(buf, utf8_prefix(domain, max_domain_size));
+    fmt::format_to(out, FMT_STRING(",\"message\":"));
+
+    std::string_view tail = "}\n";
+    std::size_t used = buf.size() + /*quotes=*/2 + tail.size();
+    if (used < EMILUA_IMPL_LOG_SINK_RECORD_SIZE) {
+        message = json_escaped_prefix(
+            message, EMILUA_IMPL_LOG_SINK_RECORD_SIZE - used);
+    } else {
+        message = {};
+    }
+    append_json_string(buf, message);
+    buf.append(tail.data(), tail.data() + tail.size());
+}
+
+log_sink::log_sink(format_type format)
+    : format{format}
+    , slots_{new slot[EMILUA_IMPL_LOG_SINK_CAPACITY]}
+{
+    for (std::size_t i = 0 ; i != EMILUA_IMPL_LOG_SINK_CAPACITY ; ++i)
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+
+    writer_ = std::thread{[this]() { writer_main(); }};
+}
+
+log_sink::~log_sink()
+{
+    stop_.store(true);
+    wakeups_.fetch_add(1);
+    wakeups_.notify_one();
+    writer_.join();
+}
+
+// Bounded MPMC queue from Dmitry Vyukov (used with a single consumer here)
+void log_sink::push(std::string_view record) noexcept
+{
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    slot* s;
+    for (;;) {
+        s = &slots_[pos % EMILUA_IMPL_LOG_SINK_CAPACITY];
+        auto seq = s->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::intptr_t>(seq) -
+            static_cast<std::intptr_t>(pos);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+
+    if (record.size() > sizeof(s->data)) {
+        std::memcpy(s->data, record.data(), sizeof(s->data) - 1);
+        s->data[sizeof(s->data) - 1] = '\n';
+        s->size = sizeof(s->data);
+    } else {
+        std::memcpy(s->data, record.data(), record.size());
+        s->size = record.size();
+    }
+    s->sequence.store(pos + 1, std::memory_order_release);
+
+    // pairs with the fence in writer_main() so either the writer sees the new
+    // record before it sleeps or we see it sleeping and wake it up
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_idle_.exchange(false)) {
+        wakeups_.fetch_add(1);
+        wakeups_.notify_one();
+    }
+}
+
+#if BOOST_OS_UNIX
+static void write_all(struct iovec* iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t nwritten = writev(STDERR_FILENO, iov, iovcnt);
+        if (nwritten == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        for (
+            ; iovcnt > 0 && static_cast<std::size_t>(nwritten) >= iov->iov_len ;
+            ++iov, --iovcnt
+        ) {
+            nwritten -= iov->iov_len;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+}
+#endif // BOOST_OS_UNIX
+
+void log_sink::writer_main()
+{
+    std::size_t tail = 0;
+    std::uint64_t reported_dropped = 0;
+    fmt::memory_buffer notice;
+#if BOOST_OS_UNIX
+    std::array<struct iovec, EMILUA_IMPL_LOG_SINK_BATCH_SIZE + 1> iov;
+#endif // BOOST_OS_UNIX
+
+    for (;;) {
+        auto wakeups = wakeups_.load();
+
+        std::size_t n = 0;
+        for (
+            ; n != EMILUA_IMPL_LOG_SINK_BATCH_SIZE && is_ready(tail + n) ; ++n
+        ) {
+            auto& s = slots_[(tail + n) % EMILUA_IMPL_LOG_SINK_CAPACITY];
+#if BOOST_OS_UNIX
+            iov[n].iov_base = s.data;
+            iov[n].iov_len = s.size;
+#else // BOOST_OS_UNIX
+            try {
+                nowide::cerr.write(s.data, s.size);
+            } catch (const std::ios_base::failure&) {}
+#endif // BOOST_OS_UNIX
+        }
+
+        std::uint64_t ndropped = dropped_.load(std::memory_order_relaxed) -
+            reported_dropped;
+        if (ndropped > 0) {
+            reported_dropped += ndropped;
+            notice.clear();
+            auto message = fmt::format(
+                FMT_STRING("{} log records dropped"), ndropped);
+            switch (format) {
+            case format_type::text:
+                fmt::format_to(
+                    fmt::appender(notice), FMT_STRING("<4>[{}] {}\n"),
+                    log_domain<default_log_domain>::name, message);
+                break;
+            case format_type::json:
+                format_json_record(
+                    notice, /*LOG_WARNING=*/4,
+                    log_domain<default_log_domain>::name, message);
+            }
+#if BOOST_OS_UNIX
+            iov[n].iov_base = notice.data();
+            iov[n].iov_len = notice.size();
+#else // BOOST_OS_UNIX
+            try {
+                nowide::cerr.write(notice.data(), notice.size());
+            } catch (const std::ios_base::failure&) {}
+#endif // BOOST_OS_UNIX
+        }
+
+        if (n == 0 && ndropped == 0) {
+            if (stop_.load())
+                break;
+
+            writer_idle_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (is_ready(tail)) {
+                writer_idle_.store(false);
+                continue;
+            }
+            wakeups_.wait(wakeups);
+            writer_idle_.store(false);
+            continue;
+        }
+
+#if BOOST_OS_UNIX
+        write_all(iov.data(), n + (ndropped > 0 ? 1 : 0));
+#endif // BOOST_OS_UNIX
+
+        for (std::size_t i = 0 ; i != n ; ++i) {
+            slots_[(tail + i) % EMILUA_IMPL_LOG_SINK_CAPACITY].sequence.store(
+                tail + i + EMILUA_IMPL_LOG_SINK_CAPACITY,
+                std::memory_order_release);
+        }
+        tail += n;
+    }
+}
+
+void app_context::init_log_sink()
+{
+    auto it = app_env.find("EMILUA_LOG_SINK");
+    if (it == app_env.end())
+        return;
+
+    log_sink::format_type format;
+    if (it->second == "async") {
+        format = log_sink::format_type::text;
+    } else if (it->second == "async-json") {
+        format = log_sink::format_type::json;
+    } else {
+        if (it->second != "sync" && it->second.size() > 0) {
+            try {
+                nowide::cerr <<
+                    "<4>Ignoring unrecognized value for EMILUA_LOG_SINK\n";
+            } catch (const std::ios_base::failure&) {}
+        }
+        return;
+    }
+
+#if EMILUA_CONFIG_THREAD_SUPPORT_LEVEL >= 1
+    try {
+        async_log_sink = std::make_unique<log_sink>(format);
+    } catch (const std::system_error& e) {
+        try {
+            fmt::print(
+                nowide::cerr,
+                FMT_STRING("<4>Failed to start the log writer thread: `{}`\n"),
+                e.what());
+        } catch (const std::ios_base::failure&) {}
+    }
+#else // EMILUA_CONFIG_THREAD_SUPPORT_LEVEL >= 1
+    boost::ignore_unused(format);
+    try {
+        nowide::cerr <<
+            "<4>EMILUA_LOG_SINK requires thread support, ignoring it\n";
+    } catch (const std::ios_base::failure&) {}
+#endif // EMILUA_CONFIG_THREAD_SUPPORT_LEVEL >= 1
+}
+
 void app_context::vlog(int priority, std::string_view domain,
                        fmt::string_view format_str, fmt::format_args args)
 {
     thread_local fmt::memory_buffer buf;
     buf.clear();
+
+    if (
+        async_log_sink &&
+        async_log_sink->format == log_sink::format_type::json
+    ) {
+        thread_local fmt::memory_buffer message;
+        message.clear();
+        fmt::vformat_to(fmt::appender(message), format_str, args);
+        format_json_record(
+            buf, priority, domain,
+            std::string_view{message.data(), message.size()});
+        async_log_sink->push(std::string_view{buf.data(), buf.size()});
+        return;
+    }
+
     auto out = fmt::appender(buf);
     switch (priority) {
     case /*LOG_EMERG=*/0:
@@ -163,13 +487,27 @@ void app_context::vlog(int priority, std::string_view domain,
         fmt::format_to(out, FMT_STRING("<_>[{}] "), domain);
         buf.data()[1] = '0' + priority;
     }
+    std::size_t prefix_size = buf.size();
     fmt::vformat_to(out, format_str, args);
-    if (stdout_has_color && priority <= /*LOG_WARNING=*/4) {
-        std::string_view tail = "\033[22;39m\n";
-        buf.append(tail.data(), tail.data() + tail.size());
-    } else {
-        buf.resize(buf.size() + 1);
-        buf.data()[buf.size() - 1] = '\n';
+    std::string_view tail = "\n";
+    if (stdout_has_color && priority <= /*LOG_WARNING=*/4)
+        tail = "\033[22;39m\n";
+    if (async_log_sink) {
+        // truncate the message (and not the colour reset that follows it) so
+        // the record fits in a log_sink slot
+        std::size_t max_size = EMILUA_IMPL_LOG_SINK_RECORD_SIZE - tail.size();
+        if (buf.size() > max_size) {
+            std::string_view message{
+                buf.data() + prefix_size, buf.size() - prefix_size};
+            message = utf8_prefix(
+                message, (max_size > prefix_size) ? max_size - prefix_size : 0);
+            buf.resize(prefix_size + message.size());
+        }
+    }
+    buf.append(tail.data(), tail.data() + tail.size());
+    if (async_log_sink) {
+        async_log_sink->push(std::string_view{buf.data(), buf.size()});
+        return;
     }
     try {
         nowide::cerr.write(buf.data(), buf.size());
@@ -192,13 +530,251 @@ properties_service::properties_service(asio::execution_context& ctx)
 void properties_service::shutdown()
 {}
 
+// LuaJIT on x64 without GC64 requires every GC object to live in the lowest
+// 2GiB of the address space and its lua_newstate() just fails (after printing
+// a complaint to stderr) so we must find out beforehand
+static bool custom_lua_allocators_supported()
+{
+    static const bool ret = []() {
+        if constexpr (sizeof(void*) == 4)
+            return true;
+
+        lua_State* L = luaL_newstate();
+        if (!L)
+            throw std::bad_alloc{};
+        lua_pushcfunction(L, luaopen_ffi);
+        lua_call(L, 0, 1);
+        lua_getfield(L, -1, "abi");
+        lua_pushliteral(L, "gc64");
+        lua_call(L, 1, 1);
+        bool gc64 = lua_toboolean(L, -1);
+        lua_close(L);
+        return gc64;
+    }();
+    return ret;
+}
+
+inbox_t::message::header&
+inbox_t::message::append(kind type, std::string_view key,
+                         std::string_view payload)
+{
+    if (open_ != 0) {
+        auto& parent = *reinterpret_cast<header*>(buffer_.get() + open_ - 1);
+        if (parent.type == kind::array)
+            key = {};
+        ++parent.size;
+    } else {
+        assert(size_ == 0);
+        key = {};
+    }
+
+    auto nbytes = record_size(key.size(), payload.size());
+    if (capacity_ - size_ < nbytes) {
+        auto new_capacity = std::max({
+            capacity_ * 2, size_ + nbytes,
+            static_cast<std::size_t>(EMILUA_IMPL_MESSAGE_INITIAL_CAPACITY)});
+        auto new_buffer = std::make_unique_for_overwrite<unsigned char[]>(
+            new_capacity);
+        if (size_ > 0)
+            std::memcpy(new_buffer.get(), buffer_.get(), size_);
+        buffer_ = std::move(new_buffer);
+        capacity_ = new_capacity;
+    }
+
+    auto data = buffer_.get() + size_;
+    auto h = new (data) header;
+    h->type = type;
+    h->key_size = key.size();
+    h->size = payload.size();
+    if (key.size() > 0)
+        std::memcpy(data + sizeof(header), key.data(), key.size());
+    if (payload.size() > 0) {
+        std::memcpy(data + sizeof(header) + key.size(), payload.data(),
+                    payload.size());
+    }
+    size_ += nbytes;
+    return *h;
+}
+
+void inbox_t::message::add_boolean(std::string_view key, bool value)
+{
+    append(kind::boolean, key).size = value ? 1 : 0;
+}
+
+void inbox_t::message::add_number(std::string_view key, lua_Number value)
+{
+    append(kind::number, key).number = value;
+}
+
+void inbox_t::message::add_string(std::string_view key,
+                                  std::string_view value)
+{
+    append(kind::string, key, value);
+}
+
+void inbox_t::message::add_handle(std::string_view key, handle_type value)
+{
+    append(kind::handle, key).size = handles_.size();
+    handles_.emplace_back(std::move(value));
+}
+
+void inbox_t::message::begin_object(std::string_view key)
+{
+    auto offset = size_;
+    append(kind::object, key).end = open_;
+    open_ = offset + 1;
+}
+
+void inbox_t::message::begin_array(std::string_view key)
+{
+    auto offset = size_;
+    append(kind::array, key).end = open_;
+    open_ = offset + 1;
+}
+
+void inbox_t::message::end_container()
+{
+    assert(open_ != 0);
+    auto& h = *reinterpret_cast<header*>(buffer_.get() + open_ - 1);
+    open_ = h.end;
+    h.end = size_;
+}
+
+vm_allocator::~vm_allocator()
+{
+    for (auto& arena: arenas_)
+        std::free(arena);
+}
+
+lua_State* vm_allocator::new_state(lua_Alloc f, void* ud)
+{
+    if (custom_lua_allocators_supported())
+        return lua_newstate(f, ud);
+
+    lua_State* L = luaL_newstate();
+    if (!L)
+        return nullptr;
+
+    upstream_ = lua_getallocf(L, &upstream_ud_);
+    size_ = static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 +
+        static_cast<std::size_t>(lua_gc(L, LUA_GCCOUNTB, 0));
+    peak_size_ = size_;
+    lua_setallocf(L, f, ud);
+    return L;
+}
+
+void* vm_allocator::reallocate(void* ptr, std::size_t osize, std::size_t nsize)
+{
+    if (!ptr)
+        osize = 0;
+
+    if (limit != 0 && nsize > osize && size_ + (nsize - osize) > limit)
+        return nullptr;
+
+    void* ret = upstream_ ? upstream_(upstream_ud_, ptr, osize, nsize)
+        : pooled_reallocate(ptr, osize, nsize);
+    if (!ret && nsize != 0)
+        return nullptr;
+
+    if (osize == 0 && nsize != 0)
+        ++allocations_;
+    size_ = size_ - osize + nsize;
+    peak_size_ = std::max(peak_size_, size_);
+    return ret;
+}
+
+void* vm_allocator::pooled_reallocate(void* ptr, std::size_t osize,
+                                      std::size_t nsize)
+{
+    constexpr auto max_small_size = EMILUA_IMPL_ALLOCATOR_MAX_SMALL_SIZE;
+
+    if (nsize == 0) {
+        if (ptr)
+            deallocate(ptr, osize);
+        return nullptr;
+    }
+
+    if (!ptr)
+        return allocate(nsize);
+
+    if (osize > max_small_size && nsize > max_small_size)
+        return std::realloc(ptr, nsize);
+
+    if (
+        osize <= max_small_size && nsize <= max_small_size &&
+        size_class(osize) == size_class(nsize)
+    ) {
+        return ptr;
+    }
+
+    void* ret = allocate(nsize);
+    if (!ret)
+        return nullptr;
+    std::memcpy(ret, ptr, std::min(osize, nsize));
+    deallocate(ptr, osize);
+    return ret;
+}
+
+void* vm_allocator::allocate(std::size_t size)
+{
+    if (size > EMILUA_IMPL_ALLOCATOR_MAX_SMALL_SIZE)
+        return std::malloc(size);
+
+    auto cls = size_class(size);
+    if (free_block* block = free_lists_[cls]) {
+        free_lists_[cls] = block->next;
+        return block;
+    }
+
+    size = (cls + 1) * granularity;
+    if (static_cast<std::size_t>(arena_end_ - arena_next_) < size) {
+        void* arena = std::malloc(EMILUA_IMPL_ALLOCATOR_ARENA_SIZE);
+        if (!arena)
+            return nullptr;
+        try {
+            arenas_.push_back(arena);
+        } catch (const std::bad_alloc&) {
+            std::free(arena);
+            return nullptr;
+        }
+
+        // the tail of the previous arena is still good for a smaller class
+        if (arena_next_ != arena_end_) {
+            auto tail = reinterpret_cast<free_block*>(arena_next_);
+            auto tail_cls = size_class(arena_end_ - arena_next_);
+            tail->next = free_lists_[tail_cls];
+            free_lists_[tail_cls] = tail;
+        }
+
+        arena_next_ = static_cast<char*>(arena);
+        arena_end_ = arena_next_ + EMILUA_IMPL_ALLOCATOR_ARENA_SIZE;
+    }
+
+    void* ret = arena_next_;
+    arena_next_ += size;
+    return ret;
+}
+
+void vm_allocator::deallocate(void* ptr, std::size_t size)
+{
+    if (size > EMILUA_IMPL_ALLOCATOR_MAX_SMALL_SIZE) {
+        std::free(ptr);
+        return;
+    }
+
+    auto block = static_cast<free_block*>(ptr);
+    auto cls = size_class(size);
+    block->next = free_lists_[cls];
+    free_lists_[cls] = block;
+}
+
 vm_context::vm_context(emilua::app_context& appctx, strand_type strand)
     : appctx(appctx)
     , strand_(std::move(strand))
     , valid_(true)
     , lua_errmem(false)
     , exit_request(false)
-    , L_(luaL_newstate())
+    , L_(allocator_.new_state(&vm_context::lua_alloc, this))
     , current_fiber_(nullptr)
 {
     if (!L_)
@@ -243,6 +819,8 @@ void vm_context::close()
         suppress_tail_errors = true;
     }
 
+    stop_profiler();
+    warm_vm_pools.clear();
     lua_close(L_);
 
     if (!suppress_tail_errors && failed_cleanup_handler_coro) {
@@ -311,7 +889,12 @@ void vm_context::close()
     for (auto& m: inbox.incoming) {
         m.wake_on_destruct = true;
     }
+    for (auto& m: inbox.blocked) {
+        m.wake_on_destruct = true;
+    }
     inbox.incoming.clear();
+    inbox.blocked.clear();
+    inbox.refill();
 
     pending_operations.clear_and_dispose([](pending_operation* op) {
         op->cancel();
@@ -377,7 +960,12 @@ void vm_context::fiber_epilogue(int resume_result)
                     for (auto& m: inbox.incoming) {
                         m.wake_on_destruct = true;
                     }
+                    for (auto& m: inbox.blocked) {
+                        m.wake_on_destruct = true;
+                    }
                     inbox.incoming.clear();
+                    inbox.blocked.clear();
+                    inbox.refill();
                 }
             }
 
@@ -409,6 +997,8 @@ void vm_context::fiber_epilogue(int resume_result)
             lua_pushthread(current_fiber_);
             lua_pushnil(current_fiber_);
             lua_rawset(current_fiber_, -5);
+            if (resume_result == 0 && !is_main)
+                recycle_fiber(*this, current_fiber_, -2, current_fiber_);
             // TODO (?): force a full GC round on `L()` now
         } else if (joiner_type == LUA_TTHREAD) {
             // Joined
@@ -456,15 +1046,29 @@ void vm_context::fiber_epilogue(int resume_result)
             if (join_handle) {
                 join_handle->fiber = nullptr;
                 join_handle->interruption_caught = interruption_caught;
+
+                rawgetp(current_fiber_, LUA_REGISTRYINDEX, &fiber_list_key);
+                lua_pushthread(current_fiber_);
+                lua_rawget(current_fiber_, -2);
+                lua_pushthread(current_fiber_);
+                lua_pushnil(current_fiber_);
+                lua_rawset(current_fiber_, -4);
+                if (resume_result == 0) {
+                    recycle_fiber(*this, current_fiber_, -1, current_fiber_);
+                } else {
+                    lua_pop(current_fiber_, 2);
+                }
             } else {
                 // do nothing; this branch executes only for modules' fibers
                 // and modules' fibers never expose a join handle to the user
             }
 
             current_fiber_ = joiner;
+            current_fiber_control_block_ = get_fiber_control_block(joiner);
+            assert(current_fiber_control_block_);
             lua_pushnil(joiner);
             set_interrupter(joiner, *this);
-            int res = lua_resume(joiner, nret + 1);
+            int res = timed_resume(joiner, nret + 1);
             // I'm assuming the compiler will eliminate this tail recursive call
             // or else we may experience stack overflow on really really long
             // join()-chains. Still better than the round-trip of post
@@ -497,6 +1101,55 @@ void vm_context::fiber_epilogue(int resume_result)
     }
 }
 
+void vm_context::enqueue_ready_fiber(
+    lua_State* fiber, bool skip_clear_interrupter,
+    std::chrono::steady_clock::time_point enqueued_at)
+{
+    ready_queue_.push_back(ready_fiber{
+        fiber, enqueued_at, skip_clear_interrupter});
+    if (ready_queue_.size() != 1)
+        return;
+
+    strand_.post([vm_ctx=shared_from_this()]() {
+        vm_ctx->drain_ready_queue();
+    }, std::allocator<void>{});
+}
+
+void vm_context::drain_ready_queue()
+{
+    // Fibers scheduled from within this batch go to a new batch so other
+    // handlers queued on the strand (e.g. IO completions) aren't starved.
+    assert(ready_batch_.empty());
+    ready_batch_.swap(ready_queue_);
+    for (const auto& f: ready_batch_) {
+        if (f.skip_clear_interrupter) {
+            fiber_resume(
+                f.fiber,
+                hana::make_set(
+                    vm_context::options::skip_clear_interrupter,
+                    hana::make_pair(
+                        vm_context::options::enqueued_at, f.enqueued_at)));
+        } else {
+            fiber_resume(
+                f.fiber,
+                hana::make_set(
+                    hana::make_pair(
+                        vm_context::options::enqueued_at, f.enqueued_at)));
+        }
+    }
+    ready_batch_.clear();
+}
+
+void* vm_context::lua_alloc(void* ud, void* ptr, std::size_t osize,
+                            std::size_t nsize)
+{
+    auto self = static_cast<vm_context*>(ud);
+    void* ret = self->allocator_.reallocate(ptr, osize, nsize);
+    if (!ret && nsize != 0)
+        self->notify_errmem();
+    return ret;
+}
+
 void vm_context::notify_errmem()
 {
     lua_errmem = true;
@@ -507,6 +1160,179 @@ void vm_context::notify_exit_request()
     exit_request = true;
 }
 
+vm_stats vm_context::stats()
+{
+    assert(strand_.running_in_this_thread());
+    vm_stats ret = stats_;
+    ret.heap_size = allocator_.size();
+    ret.peak_heap_size = allocator_.peak_size();
+    ret.allocations = allocator_.allocations();
+    if (!valid_)
+        return ret;
+
+    lua_State* L = L_;
+    if (!lua_checkstack(L, 3))
+        return ret;
+
+    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+        if (lua_tothread(L, -2) != async_event_thread_)
+            ++ret.live_fibers;
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+    return ret;
+}
+
+void vm_context::set_preemption_budget(int instructions,
+                                       std::chrono::nanoseconds time_slice)
+{
+    assert(valid_);
+    preemption_time_slice_ = time_slice;
+    if (instructions == 0 && time_slice.count() == 0) {
+        lua_sethook(L_, nullptr, 0, 0);
+        return;
+    }
+    if (instructions == 0)
+        instructions = EMILUA_IMPL_PREEMPTION_CHECK_PERIOD;
+    lua_sethook(L_, detail::preemption_hook, LUA_MASKCOUNT, instructions);
+
+    // Count hooks never run inside compiled traces so a hot loop would escape
+    // the budget for good once the JIT picks it up
+    luaJIT_setmode(L_, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+}
+
+bool vm_context::consume_preemption_budget(lua_State* L)
+{
+    // Lua hooks are per VM so this hook also runs for the async event thread
+    // and for plain coroutines. Yielding those would hand control to the wrong
+    // resumer.
+    if (!valid_ || L != current_fiber_ || L == async_event_thread_)
+        return false;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - resume_started_at_ < preemption_time_slice_)
+        return false;
+
+    if (current_fiber_control_block_->suspension_disallowed_count != 0)
+        return false;
+
+    // e.g. a Lua function called from table.sort()
+    if (!lua_isyieldable(L))
+        return false;
+
+    ++stats_.preemptions;
+    strand_.defer(
+        [vm_ctx=shared_from_this(),L,enqueued_at=now]() {
+            vm_ctx->fiber_resume(
+                L,
+                hana::make_set(
+                    vm_context::options::skip_clear_interrupter,
+                    hana::make_pair(
+                        vm_context::options::enqueued_at, enqueued_at)));
+        },
+        std::allocator<void>{});
+    return true;
+}
+
+#if LUAJIT_VERSION_NUM >= 20100
+// LuaJIT keeps the profiler state in a global variable so only one VM may be
+// profiled at a time
+static std::atomic<vm_context*> profiled_vm{nullptr};
+
+static void profiler_callback(void* data, lua_State* L, int samples,
+                              int vmstate)
+{
+    static_cast<vm_context*>(data)->record_profile_sample(L, samples, vmstate);
+}
+#endif // LUAJIT_VERSION_NUM >= 20100
+
+std::error_code vm_context::start_profiler(std::chrono::milliseconds interval)
+{
+#if LUAJIT_VERSION_NUM >= 20100
+    assert(valid_);
+    vm_context* expected = nullptr;
+    if (!profiling_ && !profiled_vm.compare_exchange_strong(expected, this))
+        return make_error_code(std::errc::device_or_resource_busy);
+
+    profiling_ = true;
+    profile_samples_.clear();
+
+    // 'f' keeps samples from JIT-compiled code attributed at function level
+    auto mode = fmt::format(
+        FMT_STRING("fi{}"),
+        std::max<std::chrono::milliseconds::rep>(interval.count(), 1));
+    luaJIT_profile_start(L_, mode.c_str(), profiler_callback, this);
+    return {};
+#else // LUAJIT_VERSION_NUM >= 20100
+    boost::ignore_unused(interval);
+    return make_error_code(std::errc::not_supported);
+#endif // LUAJIT_VERSION_NUM >= 20100
+}
+
+void vm_context::stop_profiler()
+{
+#if LUAJIT_VERSION_NUM >= 20100
+    if (!profiling_)
+        return;
+
+    luaJIT_profile_stop(L_);
+    profiling_ = false;
+    profiled_vm.store(nullptr);
+#endif // LUAJIT_VERSION_NUM >= 20100
+}
+
+std::string vm_context::profile() const
+{
+    std::string ret;
+    for (const auto& [stack, samples] : profile_samples_) {
+        fmt::format_to(
+            std::back_inserter(ret), FMT_STRING("{} {}\n"), stack, samples);
+    }
+    return ret;
+}
+
+void vm_context::record_profile_sample(lua_State* L, int samples, int vmstate)
+{
+#if LUAJIT_VERSION_NUM >= 20100
+    // `L` might be a plain coroutine, so attribution goes to the fiber that
+    // is currently scheduled instead
+    std::string stack;
+    if (current_fiber_ == async_event_thread_) {
+        stack = "[async event thread]";
+    } else if (!current_fiber_control_block_) {
+        stack = "[unknown fiber]";
+    } else if (!current_fiber_control_block_->module_path.empty()) {
+        stack = current_fiber_control_block_->module_path;
+    } else {
+        // recycled fibers share the lua_State so its address won't do
+        stack = fmt::format(
+            FMT_STRING("fiber {}"), current_fiber_control_block_->id);
+    }
+
+    std::size_t len;
+    const char* frames = luaJIT_profile_dumpstack(
+        L, "pFZ;", -EMILUA_IMPL_PROFILER_MAX_DEPTH, &len);
+    if (len > 0) {
+        stack.push_back(';');
+        stack.append(frames, len);
+    }
+
+    switch (vmstate) {
+    case 'G':
+        stack += ";[GC]";
+        break;
+    case 'J':
+        stack += ";[JIT compiler]";
+    }
+
+    profile_samples_[stack] += samples;
+#else // LUAJIT_VERSION_NUM >= 20100
+    boost::ignore_unused(L, samples, vmstate);
+#endif // LUAJIT_VERSION_NUM >= 20100
+}
+
 void vm_context::notify_deadlock(std::string msg)
 {
     deadlock_errors.emplace_back(std::move(msg));
@@ -607,69 +1433,63 @@ std::string errobj_to_string(std::variant<std::string_view, std::error_code> o)
 
 void set_interrupter(lua_State* L, vm_context& vm_ctx)
 {
-    auto current_fiber = vm_ctx.current_fiber();
-    bool interruption_disabled;
+    using interrupter_type = fiber_control_block::interrupter_type;
+    auto& control_block = vm_ctx.current_fiber_control_block();
+    if (control_block.interruption_disabled()) {
+        lua_pop(L, 1);
+        return;
+    }
 
+    bool is_nil = lua_isnil(L, -1);
+    if (is_nil && control_block.interrupter != interrupter_type::lua) {
+        // nothing stored at FiberDataIndex::INTERRUPTER to clear
+        control_block.interrupter = interrupter_type::none;
+        lua_pop(L, 1);
+        return;
+    }
+
+    auto current_fiber = vm_ctx.current_fiber();
     rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
     lua_pushthread(current_fiber);
     lua_xmove(current_fiber, L, 1);
     lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTION_DISABLED);
-    switch (lua_type(L, -1)) {
-    case LUA_TBOOLEAN:
-        interruption_disabled = lua_toboolean(L, -1);
-        break;
-    case LUA_TNUMBER:
-        interruption_disabled = lua_tointeger(L, -1) > 0;
-        break;
-    default: assert(false);
-    }
-    if (interruption_disabled) {
-        lua_pop(L, 4);
-        return;
-    }
-
-    lua_pushvalue(L, -4);
-    lua_rawseti(L, -3, FiberDataIndex::INTERRUPTER);
-    lua_pop(L, 4);
+    lua_pushvalue(L, -3);
+    lua_rawseti(L, -2, FiberDataIndex::INTERRUPTER);
+    lua_pop(L, 3);
+    control_block.interrupter =
+        is_nil ? interrupter_type::none : interrupter_type::lua;
 }
 
 asio::cancellation_slot
 set_default_interrupter(lua_State* L, vm_context& vm_ctx)
 {
-    auto current_fiber = vm_ctx.current_fiber();
-    bool interruption_disabled;
-
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTION_DISABLED);
-    switch (lua_type(L, -1)) {
-    case LUA_TBOOLEAN:
-        interruption_disabled = lua_toboolean(L, -1);
-        break;
-    case LUA_TNUMBER:
-        interruption_disabled = lua_tointeger(L, -1) > 0;
-        break;
-    default: assert(false);
-    }
-    if (interruption_disabled) {
-        lua_pop(L, 3);
+    auto& control_block = vm_ctx.current_fiber_control_block();
+    if (control_block.interruption_disabled())
         return {};
-    }
-
-    lua_rawgeti(L, -2, FiberDataIndex::ASIO_CANCELLATION_SIGNAL);
-    auto cancel_signal = static_cast<asio::cancellation_signal*>(
-        lua_touserdata(L, -1));
-    lua_rawgeti(L, -3, FiberDataIndex::DEFAULT_EMIT_SIGNAL_INTERRUPTER);
-    lua_rawseti(L, -4, FiberDataIndex::INTERRUPTER);
-    lua_pop(L, 4);
 
-    if (!cancel_signal)
-        return {};
+    if (control_block.interrupter ==
+        fiber_control_block::interrupter_type::lua) {
+        lua_pushnil(L);
+        set_interrupter(L, vm_ctx);
+    }
+    control_block.interrupter =
+        fiber_control_block::interrupter_type::default_signal;
+    return control_block.cancellation_signal.slot();
+}
 
-    return cancel_signal->slot();
+fiber_control_block* get_fiber_control_block(lua_State* fiber)
+{
+    rawgetp(fiber, LUA_REGISTRYINDEX, &fiber_list_key);
+    lua_pushthread(fiber);
+    lua_rawget(fiber, -2);
+    if (lua_type(fiber, -1) != LUA_TTABLE) {
+        lua_pop(fiber, 2);
+        return nullptr;
+    }
+    lua_rawgeti(fiber, -1, FiberDataIndex::CONTROL_BLOCK);
+    auto ret = static_cast<fiber_control_block*>(lua_touserdata(fiber, -1));
+    lua_pop(fiber, 3);
+    return ret;
 }
 
 int throw_enosys(lua_State* L)
@@ -845,39 +1665,28 @@ bool detail::unsafe_can_suspend(vm_context& vm_ctx, lua_State* L)
         return false;
     }
 
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::SUSPENSION_DISALLOWED);
-    if (lua_tointeger(L, -1) != 0) {
+    auto& control_block = vm_ctx.current_fiber_control_block();
+    if (control_block.suspension_disallowed_count != 0) {
         push(L, emilua::errc::forbid_suspend_block);
         return false;
     }
-    lua_rawgeti(L, -2, FiberDataIndex::INTERRUPTION_DISABLED);
-    bool interruption_disabled;
-    switch (lua_type(L, -1)) {
-    case LUA_TBOOLEAN:
-        interruption_disabled = lua_toboolean(L, -1);
-        break;
-    case LUA_TNUMBER:
-        interruption_disabled = lua_tointeger(L, -1) > 0;
-        break;
-    default: assert(false);
-    }
-    if (interruption_disabled) {
-        lua_pop(L, 4);
+    if (control_block.interruption_disabled())
         return true;
-    }
-    lua_rawgeti(L, -3, FiberDataIndex::INTERRUPTED);
-    if (lua_toboolean(L, -1) == 1) {
+    if (control_block.interrupted) {
         push(L, emilua::errc::interrupted);
         return false;
     }
-    lua_pop(L, 5);
     return true;
 }
 
+void detail::preemption_hook(lua_State* L, lua_Debug* /*ar*/)
+{
+    // LuaJIT unwinds this C frame when a hook yields, so no object with a
+    // non-trivial destructor may be alive here
+    if (get_vm_context(L).consume_preemption_budget(L))
+        lua_yield(L, 0);
+}
+
 bool detail::unsafe_can_suspend2(vm_context& vm_ctx, lua_State* L)
 {
     auto current_fiber = vm_ctx.current_fiber();
@@ -886,16 +1695,10 @@ bool detail::unsafe_can_suspend2(vm_context& vm_ctx, lua_State* L)
         return false;
     }
 
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::SUSPENSION_DISALLOWED);
-    if (lua_tointeger(L, -1) != 0) {
+    if (vm_ctx.current_fiber_control_block().suspension_disallowed_count != 0) {
         push(L, emilua::errc::forbid_suspend_block);
         return false;
     }
-    lua_pop(L, 3);
     return true;
 }
 
@@ -27,7 +27,8 @@ extern std::size_t spawn_start_fn_bytecode_size;
 char fiber_list_key;
 char yield_reason_is_native_key;
 static char spawn_start_fn_key;
-static char asio_cancellation_signal_mt_key;
+static char fiber_pool_key;
+static char fiber_control_block_mt_key;
 
 EMILUA_GPERF_DECLS_BEGIN(fiber)
 EMILUA_GPERF_NAMESPACE(emilua)
@@ -127,6 +128,7 @@ static int fiber_join(lua_State* L)
         lua_Integer status = lua_tointeger(L, -1);
         switch (status) {
         case FiberStatus::FINISHED_SUCCESSFULLY: {
+            int data_idx = lua_gettop(L) - 1;
             lua_pushboolean(L, 1);
             int nret = lua_gettop(handle->fiber);
             if (!lua_checkstack(L, nret)) {
@@ -138,6 +140,7 @@ static int fiber_join(lua_State* L)
             lua_pushthread(handle->fiber);
             lua_pushnil(handle->fiber);
             lua_rawset(handle->fiber, -3);
+            recycle_fiber(vm_ctx, L, data_idx, handle->fiber);
             handle->fiber = nullptr;
             handle->interruption_caught = false;
             // TODO (?): force a full GC round now
@@ -217,6 +220,11 @@ static int fiber_detach(lua_State* L)
         lua_pushthread(handle->fiber);
         lua_pushnil(handle->fiber);
         lua_rawset(handle->fiber, -5);
+        if (lua_tointeger(handle->fiber, -1) ==
+            FiberStatus::FINISHED_SUCCESSFULLY) {
+            recycle_fiber(get_vm_context(L), handle->fiber, -2,
+                          handle->fiber);
+        }
         // TODO (?): force a full GC round on `L()` now
     }
     handle->fiber = nullptr;
@@ -246,18 +254,34 @@ static int fiber_interrupt(lua_State* L)
     lua_replace(handle->fiber, -2);
     lua_xmove(handle->fiber, L, 1);
 
-    lua_pushboolean(L, 1);
-    lua_rawseti(L, -2, FiberDataIndex::INTERRUPTED);
+    lua_rawgeti(L, -1, FiberDataIndex::CONTROL_BLOCK);
+    auto control_block = static_cast<fiber_control_block*>(
+        lua_touserdata(L, -1));
+    assert(control_block);
+    lua_pop(L, 1);
+
+    control_block->interrupted = true;
 
     if (handle->fiber == vm_ctx.current_fiber())
         return 0;
 
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTER);
-    if (lua_type(L, -1) != LUA_TNIL) {
+    using interrupter_type = fiber_control_block::interrupter_type;
+    switch (control_block->interrupter) {
+    case interrupter_type::none:
+        break;
+    case interrupter_type::lua:
+        lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTER);
         lua_call(L, 0, 0);
 
         lua_pushnil(L);
         lua_rawseti(L, -2, FiberDataIndex::INTERRUPTER);
+        control_block->interrupter = interrupter_type::none;
+        break;
+    case interrupter_type::default_signal:
+        control_block->cancellation_signal.emit(
+            asio::cancellation_type::terminal);
+        control_block->interrupter = interrupter_type::none;
+        break;
     }
 
     return 0;
@@ -377,61 +401,132 @@ static int fiber_mt_gc(lua_State* L)
     return 0;
 }
 
-static int spawn(lua_State* L)
+fiber_control_block& new_fiber_control_block(lua_State* L)
 {
-    luaL_checktype(L, 1, LUA_TFUNCTION);
+    auto control_block = static_cast<fiber_control_block*>(
+        lua_newuserdata(L, sizeof(fiber_control_block)));
+    rawgetp(L, LUA_REGISTRYINDEX, &fiber_control_block_mt_key);
+    setmetatable(L, -2);
+    new (control_block) fiber_control_block{};
+    return *control_block;
+}
 
-    auto vm_ctx = get_vm_context(L).shared_from_this();
-    auto new_fiber = lua_newthread(L);
-    init_new_coro_or_fiber_scope(new_fiber, L);
+void recycle_fiber(vm_context& vm_ctx, lua_State* L, int data_idx,
+                   lua_State* fiber)
+{
+    assert(lua_status(fiber) == 0);
+    int top = lua_gettop(L);
+    if (data_idx < 0)
+        data_idx += top + 1;
+
+    if (vm_ctx.fiber_pool_size == EMILUA_IMPL_FIBER_POOL_CAPACITY ||
+        !lua_checkstack(L, 4) || !lua_checkstack(fiber, 1)) {
+        lua_settop(fiber, 0);
+        return;
+    }
 
-    rawgetp(new_fiber, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(new_fiber);
-    lua_createtable(
-        new_fiber,
-        /*narr=*/EMILUA_IMPL_INITIAL_FIBER_DATA_CAPACITY,
-        /*nrec=*/0);
-    {
-        lua_pushinteger(new_fiber, 0);
-        lua_rawseti(new_fiber, -2, FiberDataIndex::INTERRUPTION_DISABLED);
+    for (lua_Integer i = FiberDataIndex::JOINER ;
+         i <= FiberDataIndex::USER_HANDLE ; ++i) {
+        if (i == FiberDataIndex::CONTROL_BLOCK)
+            continue;
+        lua_pushnil(L);
+        lua_rawseti(L, data_idx, i);
     }
-    {
-        auto cancel_signal = static_cast<asio::cancellation_signal*>(
-            lua_newuserdata(L, sizeof(asio::cancellation_signal)));
-        rawgetp(L, LUA_REGISTRYINDEX, &asio_cancellation_signal_mt_key);
-        setmetatable(L, -2);
-        new (cancel_signal) asio::cancellation_signal{};
-        lua_pushvalue(L, -1);
 
-        lua_pushcclosure(
-            L,
-            [](lua_State* L) -> int {
-                auto cancel_signal = static_cast<asio::cancellation_signal*>(
-                    lua_touserdata(L, lua_upvalueindex(1)));
-                assert(cancel_signal);
-                cancel_signal->emit(asio::cancellation_type::terminal);
-                return 0;
-            },
-            1);
+    lua_rawgeti(L, data_idx, FiberDataIndex::CONTROL_BLOCK);
+    auto control_block = static_cast<fiber_control_block*>(
+        lua_touserdata(L, -1));
+    assert(control_block);
+    control_block->~fiber_control_block();
+    new (control_block) fiber_control_block{};
+    lua_pop(L, 1);
 
-        lua_xmove(L, new_fiber, 2);
-        lua_rawseti(new_fiber, -3,
-                    FiberDataIndex::DEFAULT_EMIT_SIGNAL_INTERRUPTER);
-        lua_rawseti(new_fiber, -2, FiberDataIndex::ASIO_CANCELLATION_SIGNAL);
+    // root scope's handlers already ran, but they're still referenced
+    rawgetp(L, LUA_REGISTRYINDEX, &scope_cleanup_handlers_key);
+    lua_pushthread(fiber);
+    lua_xmove(fiber, L, 1);
+    lua_rawget(L, -2);
+    for (int i = (int)lua_objlen(L, -1) ; i > 1 ; --i) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, i);
     }
-    lua_rawset(new_fiber, -3);
-    lua_pop(new_fiber, 1);
+    lua_rawgeti(L, -1, 1);
+    for (int i = (int)lua_objlen(L, -1) ; i > 0 ; --i) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, i);
+    }
+    lua_pop(L, 3);
+
+    int n = vm_ctx.fiber_pool_size++;
+    rawgetp(L, LUA_REGISTRYINDEX, &fiber_pool_key);
+    lua_pushthread(fiber);
+    lua_xmove(fiber, L, 1);
+    lua_rawseti(L, -2, 2 * n + 1);
+    lua_pushvalue(L, data_idx);
+    lua_rawseti(L, -2, 2 * n + 2);
+
+    lua_settop(L, top);
+    lua_settop(fiber, 0);
+}
+
+static int spawn(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+
+    auto vm_ctx = get_vm_context(L).shared_from_this();
+    lua_State* new_fiber;
+    if (vm_ctx->fiber_pool_size > 0) {
+        int n = vm_ctx->fiber_pool_size--;
+        rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
+        rawgetp(L, LUA_REGISTRYINDEX, &fiber_pool_key);
+        lua_rawgeti(L, -1, 2 * n - 1);
+        new_fiber = lua_tothread(L, -1);
+        assert(new_fiber);
+        lua_rawgeti(L, -2, 2 * n);
+        lua_rawset(L, -4);
+        lua_pushnil(L);
+        lua_rawseti(L, -2, 2 * n - 1);
+        lua_pushnil(L);
+        lua_rawseti(L, -2, 2 * n);
+        lua_pop(L, 2);
+
+        // same environment lua_newthread() would have given it
+        lua_pushvalue(L, LUA_GLOBALSINDEX);
+        lua_xmove(L, new_fiber, 1);
+        lua_replace(new_fiber, LUA_GLOBALSINDEX);
+    } else {
+        new_fiber = lua_newthread(L);
+        init_new_coro_or_fiber_scope(new_fiber, L);
+
+        rawgetp(new_fiber, LUA_REGISTRYINDEX, &fiber_list_key);
+        lua_pushthread(new_fiber);
+        lua_createtable(
+            new_fiber,
+            /*narr=*/EMILUA_IMPL_INITIAL_FIBER_DATA_CAPACITY,
+            /*nrec=*/0);
+        new_fiber_control_block(L);
+        lua_xmove(L, new_fiber, 1);
+        lua_rawseti(new_fiber, -2, FiberDataIndex::CONTROL_BLOCK);
+        lua_rawset(new_fiber, -3);
+        lua_pop(new_fiber, 1);
+    }
+    get_fiber_control_block(new_fiber)->id = ++vm_ctx->last_fiber_id;
 
     rawgetp(L, LUA_REGISTRYINDEX, &spawn_start_fn_key);
     lua_pushvalue(L, 1);
     lua_call(L, 1, 1);
     lua_xmove(L, new_fiber, 1);
 
-    vm_ctx->strand().post([vm_ctx,new_fiber]() {
-        vm_ctx->fiber_resume(
-            new_fiber,
-            hana::make_set(vm_context::options::skip_clear_interrupter));
-    }, std::allocator<void>{});
+    vm_ctx->strand().post(
+        [vm_ctx,new_fiber,enqueued_at=std::chrono::steady_clock::now()]() {
+            vm_ctx->fiber_resume(
+                new_fiber,
+                hana::make_set(
+                    vm_context::options::skip_clear_interrupter,
+                    hana::make_pair(
+                        vm_context::options::enqueued_at, enqueued_at)));
+        },
+        std::allocator<void>{});
 
     {
         auto buf = static_cast<fiber_handle*>(
@@ -454,84 +549,73 @@ static int this_fiber_yield(lua_State* L)
 
     auto current_fiber = vm_ctx->current_fiber();
     vm_ctx->strand().defer(
-        [vm_ctx,current_fiber]() {
+        [vm_ctx,current_fiber,enqueued_at=std::chrono::steady_clock::now()]() {
             vm_ctx->fiber_resume(
                 current_fiber,
-                hana::make_set(vm_context::options::skip_clear_interrupter));
+                hana::make_set(
+                    vm_context::options::skip_clear_interrupter,
+                    hana::make_pair(
+                        vm_context::options::enqueued_at, enqueued_at)));
         },
         std::allocator<void>{}
     );
     return lua_yield(L, 0);
 }
 
-inline int increment_this_fiber_counter(lua_State* L, FiberDataIndex counter)
+inline int increment_this_fiber_counter(
+    lua_State* L, lua_Integer fiber_control_block::* counter)
 {
     auto& vmctx = get_vm_context(L);
-    auto current_fiber = vmctx.current_fiber();
 
-    if (current_fiber == vmctx.async_event_thread_)
+    if (vmctx.current_fiber() == vmctx.async_event_thread_)
         return 0;
 
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, counter);
-    auto count = lua_tointeger(L, -1);
+    auto& count = vmctx.current_fiber_control_block().*counter;
     ++count;
     assert(count >= 0); //< TODO: better overflow detection and VM shutdown
-    lua_pushinteger(L, count);
-    lua_rawseti(L, -3, counter);
     return 0;
 }
 
-inline int decrement_this_fiber_counter(lua_State* L, FiberDataIndex counter,
-                                        errc e)
+inline int decrement_this_fiber_counter(
+    lua_State* L, lua_Integer fiber_control_block::* counter, errc e)
 {
     auto& vmctx = get_vm_context(L);
-    auto current_fiber = vmctx.current_fiber();
 
-    if (current_fiber == vmctx.async_event_thread_)
+    if (vmctx.current_fiber() == vmctx.async_event_thread_)
         return 0;
 
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, counter);
-    auto count = lua_tointeger(L, -1);
+    auto& count = vmctx.current_fiber_control_block().*counter;
     if (!(count > 0)) {
         push(L, e);
         return lua_error(L);
     }
-    lua_pushinteger(L, --count);
-    lua_rawseti(L, -3, counter);
+    --count;
     return 0;
 }
 
 static int this_fiber_disable_interruption(lua_State* L)
 {
     return increment_this_fiber_counter(
-        L, FiberDataIndex::INTERRUPTION_DISABLED);
+        L, &fiber_control_block::interruption_disabled_count);
 }
 
 static int this_fiber_restore_interruption(lua_State* L)
 {
     return decrement_this_fiber_counter(
-        L, FiberDataIndex::INTERRUPTION_DISABLED,
+        L, &fiber_control_block::interruption_disabled_count,
         errc::interruption_already_allowed);
 }
 
 static int this_fiber_forbid_suspend(lua_State* L)
 {
     return increment_this_fiber_counter(
-        L, FiberDataIndex::SUSPENSION_DISALLOWED);
+        L, &fiber_control_block::suspension_disallowed_count);
 }
 
 static int this_fiber_allow_suspend(lua_State* L)
 {
     return decrement_this_fiber_counter(
-        L, FiberDataIndex::SUSPENSION_DISALLOWED,
+        L, &fiber_control_block::suspension_disallowed_count,
         errc::suspension_already_allowed);
 }
 
@@ -653,16 +737,35 @@ void init_fiber_module(lua_State* L)
     }
     lua_rawset(L, LUA_REGISTRYINDEX);
 
-    lua_pushlightuserdata(L, &asio_cancellation_signal_mt_key);
+    lua_pushlightuserdata(L, &fiber_pool_key);
+    lua_createtable(
+        L, /*narr=*/2 * EMILUA_IMPL_FIBER_POOL_CAPACITY, /*nrec=*/0);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+
+    lua_pushlightuserdata(L, &fiber_control_block_mt_key);
     {
         lua_createtable(L, /*narr=*/0, /*nrec=*/1);
 
         lua_pushliteral(L, "__gc");
-        lua_pushcfunction(L, finalizer<asio::cancellation_signal>);
+        lua_pushcfunction(L, finalizer<fiber_control_block>);
         lua_rawset(L, -3);
     }
     lua_rawset(L, LUA_REGISTRYINDEX);
 
+    // the main fiber's data table is created before this module is loaded
+    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
+    lua_pushthread(L);
+    lua_rawget(L, -2);
+    {
+        auto& control_block = new_fiber_control_block(L);
+        control_block.interruption_disabled_pinned = true;
+        lua_rawgeti(L, -2, FiberDataIndex::MODULE_PATH);
+        control_block.module_path = tostringview(L);
+        lua_pop(L, 1);
+    }
+    lua_rawseti(L, -2, FiberDataIndex::CONTROL_BLOCK);
+    lua_pop(L, 2);
+
     {
         lua_pushlightuserdata(L, &spawn_start_fn_key);
         int res = luaL_loadbuffer(
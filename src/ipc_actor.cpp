@@ -1,5 +1,7 @@
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include <iostream>
 #include <charconv>
@@ -265,6 +267,229 @@ static void init_hookstate(lua_State* L)
     lua_setglobal(L, "set_no_new_privs");
 }
 
+ipc_actor_ring::~ipc_actor_ring()
+{
+    if (header)
+        munmap(header, DATA_OFFSET + capacity);
+}
+
+std::error_code ipc_actor_ring::map(int memfd)
+{
+    assert(!header);
+
+    int seals = fcntl(memfd, F_GET_SEALS);
+    if (seals == -1)
+        return std::error_code{errno, std::system_category()};
+    if (!(seals & F_SEAL_SHRINK))
+        return make_error_code(std::errc::operation_not_permitted);
+
+    struct stat st;
+    if (fstat(memfd, &st) == -1)
+        return std::error_code{errno, std::system_category()};
+    if (
+        st.st_size <= static_cast<off_t>(DATA_OFFSET) ||
+        !valid_capacity(st.st_size - DATA_OFFSET)
+    ) {
+        return make_error_code(std::errc::invalid_argument);
+    }
+
+    void* addr = mmap(/*addr=*/NULL, st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, memfd, /*offset=*/0);
+    if (addr == MAP_FAILED)
+        return std::error_code{errno, std::system_category()};
+
+    header = static_cast<ipc_actor_ring_header*>(addr);
+    data = static_cast<unsigned char*>(addr) + DATA_OFFSET;
+    capacity = st.st_size - DATA_OFFSET;
+    return {};
+}
+
+ipc_actor_ring::status ipc_actor_ring::reserve(std::uint32_t size)
+{
+    std::uint64_t head = header->head.load();
+    std::uint64_t used = pos - head;
+    if (used > capacity)
+        return status::bad;
+
+    std::uint64_t offset = pos & (capacity - 1);
+    std::uint64_t needed = record_length(size);
+    if (capacity - offset < needed)
+        needed += capacity - offset;
+    if (capacity - used < needed)
+        return status::would_block;
+    return status::ok;
+}
+
+void ipc_actor_ring::commit(const void* buf, std::uint32_t size,
+                            std::uint32_t nfds)
+{
+    std::uint64_t len = record_length(size);
+    std::uint64_t offset = pos & (capacity - 1);
+    if (capacity - offset < len) {
+        ipc_actor_ring_record rec{ipc_actor_ring_record::WRAP, 0};
+        std::memcpy(data + offset, &rec, sizeof(rec));
+        pos += capacity - offset;
+        offset = 0;
+    }
+
+    ipc_actor_ring_record rec{size, nfds};
+    std::memcpy(data + offset, &rec, sizeof(rec));
+    std::memcpy(data + offset + sizeof(rec), buf, size);
+    pos += len;
+    header->tail.store(pos);
+}
+
+void ipc_actor_ring::prepare_producer_wait()
+{
+    header->producer_sleeping.store(1);
+}
+
+void ipc_actor_ring::wake_consumer(int sockfd)
+{
+    if (header->consumer_sleeping.exchange(0) == 0)
+        return;
+
+    // if the socket is full the consumer has something to wake up for anyway
+    char c = 0;
+    auto res = send(sockfd, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    boost::ignore_unused(res);
+}
+
+ipc_actor_ring::status ipc_actor_ring::pop(
+    ipc_actor_message& out, std::uint32_t& size, std::uint32_t& nfds)
+{
+    for (;;) {
+        std::uint64_t tail = header->tail.load();
+        if (tail == pos)
+            return status::would_block;
+
+        std::uint64_t used = tail - pos;
+        if (used > capacity || used % 8 != 0)
+            return status::bad;
+
+        std::uint64_t offset = pos & (capacity - 1);
+        ipc_actor_ring_record rec;
+        std::memcpy(&rec, data + offset, sizeof(rec));
+
+        if (rec.size == ipc_actor_ring_record::WRAP) {
+            if (capacity - offset > used)
+                return status::bad;
+            pos += capacity - offset;
+            header->head.store(pos);
+            continue;
+        }
+
+        std::uint64_t len = record_length(rec.size);
+        if (
+            rec.size > sizeof(ipc_actor_message) ||
+            rec.nfds > EMILUA_CONFIG_IPC_ACTOR_MESSAGE_MAX_MEMBERS_NUMBER ||
+            len > used || len > capacity - offset
+        ) {
+            return status::bad;
+        }
+
+        // copy before validation so the producer can't change the message
+        // under our feet
+        std::memcpy(&out, data + offset + sizeof(rec), rec.size);
+        size = rec.size;
+        nfds = rec.nfds;
+        pos += len;
+        header->head.store(pos);
+        return status::ok;
+    }
+}
+
+bool ipc_actor_ring::empty() const
+{
+    return header->tail.load() == pos;
+}
+
+std::uint64_t ipc_actor_ring::max_published_records() const
+{
+    std::uint64_t used = header->tail.load() - pos;
+    if (used > capacity)
+        used = capacity;
+    return used / record_length(sizeof(ipc_actor_message::members[0]) * 2);
+}
+
+bool ipc_actor_ring::prepare_consumer_wait()
+{
+    header->consumer_sleeping.store(1);
+    return empty();
+}
+
+void ipc_actor_ring::wake_producer(int sockfd)
+{
+    if (header->producer_sleeping.exchange(0) == 0)
+        return;
+
+    char c = 0;
+    auto res = send(sockfd, &c, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    boost::ignore_unused(res);
+}
+
+enum class ring_control_status
+{
+    ok,
+    empty,
+    eof,
+    bad
+};
+
+// Reads one datagram from the private socket of a ring. Received descriptors
+// are appended to `fds`.
+static ring_control_status recv_ring_control(int sockfd, std::vector<int>& fds)
+{
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+
+    char c;
+    struct iovec iov;
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(
+            sizeof(int) * EMILUA_CONFIG_IPC_ACTOR_MESSAGE_MAX_MEMBERS_NUMBER)];
+    } cmsgu;
+    msg.msg_control = cmsgu.buf;
+    msg.msg_controllen = sizeof(cmsgu.buf);
+
+    auto nread = recvmsg(sockfd, &msg, MSG_DONTWAIT);
+    if (nread == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return ring_control_status::empty;
+        return ring_control_status::bad;
+    }
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg) ; cmsg != NULL ;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+
+        char* in = (char*)CMSG_DATA(cmsg);
+        auto nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (std::size_t i = 0 ; i != nfds ; ++i) {
+            int fd;
+            std::memcpy(&fd, in, sizeof(int));
+            in += sizeof(int);
+            if (fd != -1)
+                fds.emplace_back(fd);
+        }
+    }
+
+    if (nread == 0)
+        return ring_control_status::eof;
+    if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        return ring_control_status::bad;
+    return ring_control_status::ok;
+}
+
 void ipc_actor_inbox_op::do_wait()
 {
     service->sock.async_wait(
@@ -278,6 +503,13 @@ void ipc_actor_inbox_op::do_wait()
     );
 }
 
+void ipc_actor_inbox_op::do_poll()
+{
+    executor.post([self=shared_from_this()]() {
+        self->on_wait(boost::system::error_code{});
+    }, std::allocator<void>{});
+}
+
 void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
 {
     auto vm_ctx = this->vm_ctx.lock();
@@ -293,6 +525,11 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
     }
 
     auto recv_fiber = vm_ctx->inbox.recv_fiber;
+    if (!ec && service->ring) {
+        consume_ring(vm_ctx);
+        return;
+    }
+
     if (ec) {
         vm_ctx->pending_operations.erase(
             vm_ctx->pending_operations.iterator_to(*service));
@@ -379,9 +616,28 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
         }
     }
 
+    // The spawner sends the ring setup before anybody else can reach this
+    // socket so it must come first and only when announced. A ring setup
+    // accepted anywhere else would let any peer make us map memory and grow
+    // `nsenders` at will.
+    bool is_ring_setup =
+        nread == static_cast<ssize_t>(sizeof(message.members[0]) * 2) &&
+        message.members[0].as_int ==
+        (EXPONENT_MASK | ipc_actor_message::nil) &&
+        message.members[1].as_int ==
+        (EXPONENT_MASK | ipc_actor_message::ring_setup);
+    bool expects_ring_setup = std::exchange(service->expects_ring_setup, false);
+    std::unique_ptr<ipc_actor_ring> ring;
+    if (expects_ring_setup && is_ring_setup && fds.size() == 2) {
+        ring = std::make_unique<ipc_actor_ring>();
+        if (ring->map(fds[0]))
+            ring.reset();
+    }
+
     if (
         nread < static_cast<ssize_t>(sizeof(message.members[0]) * 2) ||
-        (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+        ((expects_ring_setup || is_ring_setup) && !ring)
     ) {
         vm_ctx->pending_operations.erase(
             vm_ctx->pending_operations.iterator_to(*service));
@@ -398,7 +654,140 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
         }
         return;
     }
+
+    if (ring) {
+        auto ring_service = new ipc_actor_inbox_service{
+            executor.context(), fds[1], std::move(ring)};
+        fds[1] = -1;
+        ++vm_ctx->inbox.nsenders;
+        vm_ctx->pending_operations.push_back(*ring_service);
+        if (recv_fiber)
+            ring_service->async_enqueue(*vm_ctx);
+        do_wait();
+        return;
+    }
+
     service->running = false;
+    on_message(vm_ctx, message, nread, fds);
+}
+
+void ipc_actor_inbox_op::consume_ring(std::shared_ptr<vm_context>& vm_ctx)
+{
+    auto& ring = *service->ring;
+    int sockfd = service->sock.native_handle();
+
+    auto remove_service = [&]() {
+        auto recv_fiber = vm_ctx->inbox.recv_fiber;
+        vm_ctx->pending_operations.erase(
+            vm_ctx->pending_operations.iterator_to(*service));
+        delete service;
+        if (--vm_ctx->inbox.nsenders == 0 && recv_fiber) {
+            vm_ctx->inbox.recv_fiber = nullptr;
+            vm_ctx->inbox.work_guard.reset();
+            vm_ctx->fiber_resume(
+                recv_fiber,
+                hana::make_set(
+                    hana::make_pair(
+                        vm_context::options::arguments,
+                        hana::make_tuple(errc::no_senders))));
+        }
+    };
+
+    ipc_actor_message message;
+    std::uint32_t size;
+    std::uint32_t nfds;
+    for (;;) {
+        switch (ring.pop(message, size, nfds)) {
+        case ipc_actor_ring::status::bad:
+            remove_service();
+            return;
+        case ipc_actor_ring::status::would_block:
+            break;
+        case ipc_actor_ring::status::ok: {
+            if (size < sizeof(message.members[0]) * 2) {
+                remove_service();
+                return;
+            }
+
+            // the producer sends the descriptors before it publishes the
+            // record so they must be available already (`nfds` was already
+            // validated by pop() and we stop reading as soon as this record
+            // is covered)
+            while (service->ring_fds.size() < nfds) {
+                if (
+                    recv_ring_control(sockfd, service->ring_fds) !=
+                    ring_control_status::ok
+                ) {
+                    remove_service();
+                    return;
+                }
+            }
+
+            std::vector<int> fds(
+                service->ring_fds.begin(), service->ring_fds.begin() + nfds);
+            service->ring_fds.erase(
+                service->ring_fds.begin(), service->ring_fds.begin() + nfds);
+            BOOST_SCOPE_EXIT_ALL(&) {
+                for (auto& fd: fds) {
+                    if (fd != -1) {
+                        int res = close(fd);
+                        boost::ignore_unused(res);
+                    }
+                }
+            };
+
+            ring.wake_producer(sockfd);
+            service->running = false;
+            on_message(vm_ctx, message, size, fds);
+            return;
+        }
+        }
+
+        for (bool done = false ; !done ;) {
+            switch (recv_ring_control(sockfd, service->ring_fds)) {
+            case ring_control_status::ok:
+                // The producer may be ahead of us by several records (each
+                // one with its own descriptors), but never by more than the
+                // records already published plus the one it's preparing.
+                if (
+                    service->ring_fds.size() >
+                    (ring.max_published_records() + 1) *
+                    EMILUA_CONFIG_IPC_ACTOR_MESSAGE_MAX_MEMBERS_NUMBER
+                ) {
+                    remove_service();
+                    return;
+                }
+                break;
+            case ring_control_status::empty:
+                done = true;
+                break;
+            case ring_control_status::eof:
+                // records published before the producer went away are still
+                // delivered
+                if (ring.empty()) {
+                    remove_service();
+                    return;
+                }
+                done = true;
+                break;
+            case ring_control_status::bad:
+                remove_service();
+                return;
+            }
+        }
+
+        if (ring.prepare_consumer_wait()) {
+            do_wait();
+            return;
+        }
+    }
+}
+
+void ipc_actor_inbox_op::on_message(
+    std::shared_ptr<vm_context>& vm_ctx, ipc_actor_message& message,
+    ssize_t nread, std::vector<int>& fds)
+{
+    auto recv_fiber = vm_ctx->inbox.recv_fiber;
 
     auto remove_service = [&]() {
         // Ideally we wouldn't close the channel because the assumption is that
@@ -424,17 +813,23 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
         return v.data() + v.size() <= reinterpret_cast<char*>(&message) + nread;
     };
 
-    if (!recv_fiber) {
+    if (!recv_fiber || vm_ctx->inbox.recv_max != 0) {
+        // if the message turns out to be bad and is dropped, the scheduled
+        // wakeup finds nothing new and does nothing
+        if (recv_fiber)
+            schedule_batch_receive(vm_ctx);
+
         auto& queue = vm_ctx->inbox.incoming;
         queue.emplace_back(std::nullopt);
+        BOOST_SCOPE_EXIT_ALL(&) { vm_ctx->inbox.refill(); };
 
         if (
             message.members[0].as_int ==
             (EXPONENT_MASK | ipc_actor_message::nil)
         ) {
             if (!is_snan(message.members[1].as_int)) {
-                queue.back().msg.emplace<lua_Number>(
-                    message.members[1].as_double);
+                queue.back().msg.add_number(
+                    {}, message.members[1].as_double);
                 return;
             }
 
@@ -444,10 +839,10 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                 queue.pop_back();
                 return;
             case ipc_actor_message::boolean_true:
-                queue.back().msg.emplace<bool>(true);
+                queue.back().msg.add_boolean({}, true);
                 break;
             case ipc_actor_message::boolean_false:
-                queue.back().msg.emplace<bool>(false);
+                queue.back().msg.add_boolean({}, false);
                 break;
             case ipc_actor_message::string: {
                 std::string_view v(reinterpret_cast<char*>(message.strbuf) + 1,
@@ -457,7 +852,7 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                     queue.pop_back();
                     return;
                 }
-                queue.back().msg.emplace<std::string>(v);
+                queue.back().msg.add_string({}, v);
                 break;
             }
             case ipc_actor_message::file_descriptor: {
@@ -467,9 +862,8 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                     return;
                 }
 
-                queue.back().msg.emplace<
-                    std::shared_ptr<inbox_t::file_descriptor_box>
-                >(std::make_shared<inbox_t::file_descriptor_box>(fds[0]));
+                queue.back().msg.add_handle(
+                    {}, std::make_shared<inbox_t::file_descriptor_box>(fds[0]));
                 fds[0] = -1;
                 break;
             }
@@ -480,8 +874,11 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                     return;
                 }
 
-                queue.back().msg.emplace<inbox_t::ipc_actor_address>(
-                    std::make_shared<inbox_t::file_descriptor_box>(fds[0]));
+                queue.back().msg.add_handle(
+                    {},
+                    inbox_t::ipc_actor_address{
+                        std::make_shared<inbox_t::file_descriptor_box>(
+                            fds[0])});
                 fds[0] = -1;
                 break;
             }
@@ -500,8 +897,8 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
             strit += size;
             return ret;
         };
-        auto& dict = queue.back().msg.emplace<
-            std::map<std::string, inbox_t::value_type>>();
+        auto& dict = queue.back().msg;
+        dict.begin_object({});
 
         decltype(fds)::size_type fdsidx = 0;
         for (
@@ -525,7 +922,7 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
             }
 
             if (!is_snan(message.members[nf].as_int)) {
-                dict.emplace(key, lua_Number(message.members[nf].as_double));
+                dict.add_number(key, message.members[nf].as_double);
                 continue;
             }
 
@@ -535,10 +932,10 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                 queue.pop_back();
                 return;
             case ipc_actor_message::boolean_true:
-                dict.emplace(key, true);
+                dict.add_boolean(key, true);
                 break;
             case ipc_actor_message::boolean_false:
-                dict.emplace(key, false);
+                dict.add_boolean(key, false);
                 break;
             case ipc_actor_message::string: {
                 auto value = nextstr();
@@ -547,7 +944,7 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                     queue.pop_back();
                     return;
                 }
-                dict.emplace(key, static_cast<std::string>(value));
+                dict.add_string(key, value);
                 break;
             }
             case ipc_actor_message::file_descriptor:
@@ -557,7 +954,7 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                     return;
                 }
 
-                dict.emplace(
+                dict.add_handle(
                     key,
                     std::make_shared<inbox_t::file_descriptor_box>(
                         fds[fdsidx]));
@@ -570,7 +967,7 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                     return;
                 }
 
-                dict.emplace(
+                dict.add_handle(
                     key,
                     inbox_t::ipc_actor_address{
                         std::make_shared<inbox_t::file_descriptor_box>(
@@ -579,6 +976,7 @@ void ipc_actor_inbox_op::on_wait(const boost::system::error_code& ec)
                 break;
             }
         }
+        dict.end_container();
         return;
     }
 
@@ -1055,6 +1453,7 @@ static int child_main(void*)
 
     int main_ctx_concurrency_hint;
     fs::path entry_point;
+    bool expects_ring_setup;
 
     app_context appctx;
     appctx.app_args.reserve(2);
@@ -1075,6 +1474,7 @@ static int child_main(void*)
         str.clear();
 
         ia >> environ_buffer1;
+        ia >> expects_ring_setup;
         environ_buffer2.reserve(environ_buffer1.size() + 1);
         for (auto& s : environ_buffer1) {
             environ_buffer2.emplace_back(s.data());
@@ -1139,6 +1539,8 @@ static int child_main(void*)
             emilua::log_domain<emilua::default_log_domain>::log_level = level;
     }
 
+    appctx.init_log_sink();
+
     asio::io_context ioctx{main_ctx_concurrency_hint};
     asio::make_service<properties_service>(ioctx, main_ctx_concurrency_hint);
 
@@ -1159,12 +1561,17 @@ static int child_main(void*)
         }
     }
 
+    // EMILUA_BYTECODE_CACHE is deliberately ignored here. A sandboxed actor
+    // able to write to the cache directory could plant crafted bytecode (which
+    // isn't memory-safe to load) for the trusted parent to pick up later.
+
     try {
         auto vm_ctx = make_vm(ioctx, appctx, ContextType::worker, entry_point);
         appctx.master_vm = vm_ctx;
 
         ++vm_ctx->inbox.nsenders;
         auto inbox_service = new ipc_actor_inbox_service{ioctx, inboxfd};
+        inbox_service->expects_ring_setup = expects_ring_setup;
         vm_ctx->pending_operations.push_back(*inbox_service);
 
         vm_ctx->strand().post([vm_ctx]() {
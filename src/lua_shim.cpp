@@ -24,20 +24,13 @@ static char busy_coroutines_key;
 
 static int restore_interruption(lua_State* L)
 {
-    auto current_fiber = get_vm_context(L).current_fiber();
-
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTION_DISABLED);
-    auto count = lua_tointeger(L, -1);
+    auto& count = get_vm_context(L).current_fiber_control_block()
+        .interruption_disabled_count;
     if (!(count > 0)) {
         push(L, errc::interruption_already_allowed);
         return lua_error(L);
     }
-    lua_pushinteger(L, --count);
-    lua_rawseti(L, -3, FiberDataIndex::INTERRUPTION_DISABLED);
+    --count;
     return 0;
 }
 
@@ -124,27 +117,11 @@ static int is_busy(lua_State* L)
 
 static int check_not_interrupted(lua_State* L)
 {
-    auto current_fiber = get_vm_context(L).current_fiber();
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTION_DISABLED);
-    bool interruption_disabled;
-    switch (lua_type(L, -1)) {
-    case LUA_TBOOLEAN:
-        interruption_disabled = lua_toboolean(L, -1);
-        break;
-    case LUA_TNUMBER:
-        interruption_disabled = lua_tointeger(L, -1) > 0;
-        break;
-    default: assert(false);
-    }
-    if (interruption_disabled)
+    auto& control_block = get_vm_context(L).current_fiber_control_block();
+    if (control_block.interruption_disabled())
         return 0;
 
-    lua_rawgeti(L, -2, FiberDataIndex::INTERRUPTED);
-    if (lua_toboolean(L, -1) == 1) {
+    if (control_block.interrupted) {
         push(L, emilua::errc::interrupted);
         return lua_error(L);
     }
@@ -100,13 +100,11 @@ static int mutex_unlock(lua_State* L)
         return 0;
     }
 
-    auto vm_ctx = handle->vm_ctx.shared_from_this();
     auto next = handle->pending.front();
     handle->pending.pop_front();
-    vm_ctx->strand().post([vm_ctx,next]() {
-        vm_ctx->fiber_resume(
-            next, hana::make_set(vm_context::options::skip_clear_interrupter));
-    }, std::allocator<void>{});
+    handle->vm_ctx.enqueue_ready_fiber(
+        next, /*skip_clear_interrupter=*/true,
+        std::chrono::steady_clock::now());
     return 0;
 }
 EMILUA_GPERF_DECLS_END(mutex)
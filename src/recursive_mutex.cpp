@@ -144,10 +144,9 @@ static int recursive_mutex_unlock(lua_State* L)
     handle->pending.pop_front();
     handle->owner = next;
     handle->nlocked = 1;
-    vm_ctx.strand().post([vm_ctx=vm_ctx.shared_from_this(),next]() {
-        vm_ctx->fiber_resume(
-            next, hana::make_set(vm_context::options::skip_clear_interrupter));
-    }, std::allocator<void>{});
+    vm_ctx.enqueue_ready_fiber(
+        next, /*skip_clear_interrupter=*/true,
+        std::chrono::steady_clock::now());
     return 0;
 }
 EMILUA_GPERF_DECLS_END(recursive_mutex)
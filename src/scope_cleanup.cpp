@@ -17,37 +17,21 @@ char scope_cleanup_handlers_key;
 
 static void disable_interruption(lua_State* L)
 {
-    auto current_fiber = get_vm_context(L).current_fiber();
-
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTION_DISABLED);
-    auto count = lua_tointeger(L, -1);
+    auto& count = get_vm_context(L).current_fiber_control_block()
+        .interruption_disabled_count;
     ++count;
     assert(count >= 0); //< TODO: better overflow detection and VM shutdown
-    lua_pushinteger(L, count);
-    lua_rawseti(L, -3, FiberDataIndex::INTERRUPTION_DISABLED);
-    lua_pop(L, 3);
 }
 
 static int restore_interruption(lua_State* L)
 {
-    auto current_fiber = get_vm_context(L).current_fiber();
-
-    rawgetp(L, LUA_REGISTRYINDEX, &fiber_list_key);
-    lua_pushthread(current_fiber);
-    lua_xmove(current_fiber, L, 1);
-    lua_rawget(L, -2);
-    lua_rawgeti(L, -1, FiberDataIndex::INTERRUPTION_DISABLED);
-    auto count = lua_tointeger(L, -1);
+    auto& count = get_vm_context(L).current_fiber_control_block()
+        .interruption_disabled_count;
     if (!(count > 0)) {
         push(L, errc::interruption_already_allowed);
         return lua_error(L);
     }
-    lua_pushinteger(L, --count);
-    lua_rawseti(L, -3, FiberDataIndex::INTERRUPTION_DISABLED);
+    --count;
     return 0;
 }
 
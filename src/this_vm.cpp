@@ -0,0 +1,225 @@
+/* Copyright (c) 2023 Vinícius dos Santos Oliveira
+
+   Distributed under the Boost Software License, Version 1.0. (See accompanying
+   file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt) */
+
+EMILUA_GPERF_DECLS_BEGIN(includes)
+#include <emilua/this_vm.hpp>
+EMILUA_GPERF_DECLS_END(includes)
+
+namespace emilua {
+
+EMILUA_GPERF_DECLS_BEGIN(this_vm)
+EMILUA_GPERF_NAMESPACE(emilua)
+static void push_histogram(lua_State* L, const vm_stats::histogram_type& h)
+{
+    lua_createtable(L, /*narr=*/h.size(), /*nrec=*/0);
+    for (std::size_t i = 0 ; i != h.size() ; ++i) {
+        lua_pushnumber(L, static_cast<lua_Number>(h[i]));
+        lua_rawseti(L, -2, i + 1);
+    }
+}
+
+static int this_vm_stats(lua_State* L)
+{
+    auto stats = get_vm_context(L).stats();
+    lua_createtable(L, /*narr=*/0, /*nrec=*/11);
+
+    lua_pushliteral(L, "resumes");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.resumes));
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "run_time");
+    lua_pushnumber(
+        L, std::chrono::duration<lua_Number>{stats.run_time}.count());
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "run_time_histogram");
+    push_histogram(L, stats.run_time_histogram);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "queue_delay_samples");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.queue_delay_samples));
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "queue_delay");
+    lua_pushnumber(
+        L, std::chrono::duration<lua_Number>{stats.queue_delay}.count());
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "queue_delay_histogram");
+    push_histogram(L, stats.queue_delay_histogram);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "preemptions");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.preemptions));
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "live_fibers");
+    lua_pushinteger(L, stats.live_fibers);
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "heap_size");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.heap_size));
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "peak_heap_size");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.peak_heap_size));
+    lua_rawset(L, -3);
+
+    lua_pushliteral(L, "allocations");
+    lua_pushnumber(L, static_cast<lua_Number>(stats.allocations));
+    lua_rawset(L, -3);
+
+    return 1;
+}
+
+static int this_vm_start_profiler(lua_State* L)
+{
+    std::chrono::milliseconds interval{10};
+    switch (lua_type(L, 1)) {
+    case LUA_TNIL:
+        break;
+    case LUA_TNUMBER: {
+        lua_Number secs = lua_tonumber(L, 1);
+        if (!(secs >= 0.001) || secs > 3600) {
+            push(L, std::errc::argument_out_of_domain, "arg", 1);
+            return lua_error(L);
+        }
+        interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::duration<lua_Number>{secs});
+        break;
+    }
+    default:
+        push(L, std::errc::invalid_argument, "arg", 1);
+        return lua_error(L);
+    }
+
+    if (auto ec = get_vm_context(L).start_profiler(interval) ; ec) {
+        push(L, ec);
+        return lua_error(L);
+    }
+    return 0;
+}
+
+static int this_vm_stop_profiler(lua_State* L)
+{
+    get_vm_context(L).stop_profiler();
+    return 0;
+}
+
+static int this_vm_profile(lua_State* L)
+{
+    push(L, get_vm_context(L).profile());
+    return 1;
+}
+
+static int this_vm_log(lua_State* L)
+{
+    if (lua_type(L, 1) != LUA_TNUMBER) {
+        push(L, std::errc::invalid_argument, "arg", 1);
+        return lua_error(L);
+    }
+    lua_Number priority = lua_tonumber(L, 1);
+    if (!(priority >= /*LOG_EMERG=*/0 && priority <= /*LOG_DEBUG=*/7)) {
+        push(L, std::errc::argument_out_of_domain, "arg", 1);
+        return lua_error(L);
+    }
+
+    if (lua_type(L, 2) != LUA_TSTRING) {
+        push(L, std::errc::invalid_argument, "arg", 2);
+        return lua_error(L);
+    }
+
+    get_vm_context(L).appctx.log<default_log_domain>(
+        static_cast<int>(priority), "{}", tostringview(L, 2));
+    return 0;
+}
+
+static int this_vm_log_dropped(lua_State* L)
+{
+    auto& appctx = get_vm_context(L).appctx;
+    std::uint64_t dropped = appctx.async_log_sink ?
+        appctx.async_log_sink->dropped() : 0;
+    lua_pushnumber(L, static_cast<lua_Number>(dropped));
+    return 1;
+}
+EMILUA_GPERF_DECLS_END(this_vm)
+
+static int this_vm_mt_index(lua_State* L)
+{
+    auto key = tostringview(L, 2);
+    return EMILUA_GPERF_BEGIN(key)
+        EMILUA_GPERF_PARAM(int (*action)(lua_State*))
+        EMILUA_GPERF_DEFAULT_VALUE([](lua_State* L) -> int {
+            push(L, errc::bad_index, "index", 2);
+            return lua_error(L);
+        })
+        EMILUA_GPERF_PAIR(
+            "stats",
+            [](lua_State* L) -> int {
+                lua_pushcfunction(L, this_vm_stats);
+                return 1;
+            })
+        EMILUA_GPERF_PAIR(
+            "start_profiler",
+            [](lua_State* L) -> int {
+                lua_pushcfunction(L, this_vm_start_profiler);
+                return 1;
+            })
+        EMILUA_GPERF_PAIR(
+            "stop_profiler",
+            [](lua_State* L) -> int {
+                lua_pushcfunction(L, this_vm_stop_profiler);
+                return 1;
+            })
+        EMILUA_GPERF_PAIR(
+            "profile",
+            [](lua_State* L) -> int {
+                lua_pushcfunction(L, this_vm_profile);
+                return 1;
+            })
+        EMILUA_GPERF_PAIR(
+            "log",
+            [](lua_State* L) -> int {
+                lua_pushcfunction(L, this_vm_log);
+                return 1;
+            })
+        EMILUA_GPERF_PAIR(
+            "log_dropped",
+            [](lua_State* L) -> int {
+                lua_pushcfunction(L, this_vm_log_dropped);
+                return 1;
+            })
+    EMILUA_GPERF_END(key)(L);
+}
+
+void init_this_vm_module(lua_State* L)
+{
+    lua_pushliteral(L, "this_vm");
+    lua_newtable(L);
+    {
+        lua_newtable(L);
+
+        lua_pushliteral(L, "__metatable");
+        lua_pushliteral(L, "this_vm");
+        lua_rawset(L, -3);
+
+        lua_pushliteral(L, "__index");
+        lua_pushcfunction(L, this_vm_mt_index);
+        lua_rawset(L, -3);
+
+        lua_pushliteral(L, "__newindex");
+        lua_pushcfunction(
+            L,
+            [](lua_State* L) -> int {
+                push(L, std::errc::operation_not_permitted);
+                return lua_error(L);
+            });
+        lua_rawset(L, -3);
+    }
+    setmetatable(L, -2);
+    lua_rawset(L, LUA_GLOBALSINDEX);
+}
+
+} // namespace emilua
@@ -9,7 +9,12 @@ EMILUA_GPERF_DECLS_BEGIN(includes)
 #include <boost/asio/detail/scheduler.hpp>
 #endif // defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
 
+#include <array>
+#include <ctime>
+#include <deque>
+
 #include <boost/asio/steady_timer.hpp>
+#include <boost/intrusive/list.hpp>
 
 #include <emilua/async_base.hpp>
 #include <emilua/time.hpp>
@@ -30,6 +35,14 @@ static char steady_timer_mt_key;
 static char steady_timer_wait_key;
 
 using lua_Seconds = std::chrono::duration<lua_Number>;
+
+template<class Rep, class Period>
+static lua_Number to_lua_nanoseconds(std::chrono::duration<Rep, Period> d)
+{
+    // integer conversion first so the result is only rounded once
+    return static_cast<lua_Number>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
 EMILUA_GPERF_DECLS_END(time)
 
 struct sleep_for_operation: public pending_operation
@@ -49,6 +62,300 @@ struct sleep_for_operation: public pending_operation
     asio::steady_timer timer;
 };
 
+#if BOOST_OS_LINUX
+// CLOCK_*_COARSE clocks only read the timestamp the kernel cached at its last
+// tick (a few milliseconds of resolution) and never touch the hardware
+// counter, so they're considerably cheaper than their precise counterparts
+static lua_Number coarse_clock_nanoseconds(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return static_cast<lua_Number>(
+        static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+}
+#endif // BOOST_OS_LINUX
+
+static char coarse_timer_wheel_key;
+
+// Hashed timing wheel shared by every time.coarse_sleep() in the VM. Sleepers
+// are only woken up at tick boundaries so insertion and cancellation are O(1)
+// and a single asio timer serves all of them.
+struct coarse_timer_wheel: public pending_operation
+{
+    struct entry
+        : public boost::intrusive::list_base_hook<
+            boost::intrusive::link_mode<boost::intrusive::auto_unlink>>
+    {
+        lua_State* fiber;
+        std::uint64_t expiry_tick;
+
+        // bumped whenever the entry is recycled so stale interrupters can tell
+        // the entry no longer belongs to them
+        std::uint64_t generation = 0;
+    };
+
+    using entry_list = boost::intrusive::list<
+        entry, boost::intrusive::constant_time_size<false>>;
+
+    coarse_timer_wheel(asio::io_context& ctx)
+        : pending_operation{/*shared_ownership=*/true}
+        , timer{ctx}
+    {}
+
+    void cancel() noexcept override
+    {
+        try {
+            timer.cancel();
+        } catch (const boost::system::system_error&) {}
+    }
+
+    entry& acquire_entry()
+    {
+        if (free_entries.empty()) {
+            storage.emplace_back();
+            return storage.back();
+        }
+
+        auto& e = free_entries.front();
+        e.unlink();
+        return e;
+    }
+
+    void release_entry(entry& e)
+    {
+        e.unlink();
+        ++e.generation;
+        free_entries.push_back(e);
+        --size;
+    }
+
+    std::uint64_t ticks_since_origin(std::chrono::steady_clock::time_point tp)
+    {
+        if (tp <= origin)
+            return 0;
+        return static_cast<std::uint64_t>((tp - origin) / granularity);
+    }
+
+    asio::steady_timer timer;
+    std::chrono::steady_clock::duration granularity =
+        std::chrono::milliseconds{10};
+    std::chrono::steady_clock::time_point origin;
+
+    // every tick up to (and including) this one has been processed already
+    std::uint64_t current_tick = 0;
+
+    std::size_t size = 0;
+    bool running = false;
+    std::array<entry_list, EMILUA_IMPL_COARSE_TIMER_WHEEL_SLOTS> slots;
+
+    // entries are recycled so steady-state sleeps don't allocate
+    std::deque<entry> storage;
+    entry_list free_entries;
+};
+
+static std::shared_ptr<coarse_timer_wheel>&
+get_coarse_timer_wheel(lua_State* L, vm_context& vm_ctx)
+{
+    rawgetp(L, LUA_REGISTRYINDEX, &coarse_timer_wheel_key);
+    auto wheel = static_cast<std::shared_ptr<coarse_timer_wheel>*>(
+        lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (wheel)
+        return *wheel;
+
+    lua_pushlightuserdata(L, &coarse_timer_wheel_key);
+    wheel = static_cast<std::shared_ptr<coarse_timer_wheel>*>(
+        lua_newuserdata(L, sizeof(std::shared_ptr<coarse_timer_wheel>)));
+    {
+        lua_createtable(L, /*narr=*/0, /*nrec=*/1);
+        lua_pushliteral(L, "__gc");
+        lua_pushcfunction(L, finalizer<std::shared_ptr<coarse_timer_wheel>>);
+        lua_rawset(L, -3);
+        setmetatable(L, -2);
+    }
+    new (wheel) std::shared_ptr<coarse_timer_wheel>{};
+    lua_rawset(L, LUA_REGISTRYINDEX);
+
+    *wheel = std::make_shared<coarse_timer_wheel>(vm_ctx.strand().context());
+    return *wheel;
+}
+
+static void arm_coarse_timer_wheel(
+    const std::shared_ptr<coarse_timer_wheel>& wheel,
+    const std::shared_ptr<vm_context>& vm_ctx)
+{
+    wheel->timer.expires_at(
+        wheel->origin + wheel->granularity * (wheel->current_tick + 1));
+    wheel->timer.async_wait(asio::bind_executor(
+        vm_ctx->strand_using_defer(),
+        [vm_ctx,wheel](const boost::system::error_code& ec) {
+            if (!vm_ctx->valid())
+                return;
+
+            if (ec) {
+                wheel->running = false;
+                vm_ctx->pending_operations.erase(
+                    vm_ctx->pending_operations.iterator_to(*wheel));
+                return;
+            }
+
+            auto now_tick = wheel->ticks_since_origin(
+                std::chrono::steady_clock::now());
+
+            // a late handler only needs to visit each slot once
+            coarse_timer_wheel::entry_list expired;
+            auto last_tick = std::min<std::uint64_t>(
+                now_tick,
+                wheel->current_tick + EMILUA_IMPL_COARSE_TIMER_WHEEL_SLOTS);
+            for (auto t = wheel->current_tick + 1 ; t <= last_tick ; ++t) {
+                auto& slot = wheel->slots[
+                    t % EMILUA_IMPL_COARSE_TIMER_WHEEL_SLOTS];
+                for (auto it = slot.begin() ; it != slot.end() ;) {
+                    auto& e = *it++;
+                    if (e.expiry_tick <= now_tick) {
+                        e.unlink();
+                        expired.push_back(e);
+                    }
+                }
+            }
+            wheel->current_tick = std::max(wheel->current_tick, now_tick);
+
+            // resumed fibers might schedule new sleeps (and even close the
+            // VM) so the expired entries were taken out of the wheel first
+            while (!expired.empty()) {
+                auto& e = expired.front();
+                lua_State* fiber = e.fiber;
+                wheel->release_entry(e);
+                if (!vm_ctx->valid())
+                    continue;
+
+                auto opt_args = vm_context::options::arguments;
+                vm_ctx->fiber_resume(
+                    fiber,
+                    hana::make_set(
+                        vm_context::options::fast_auto_detect_interrupt,
+                        hana::make_pair(
+                            opt_args,
+                            hana::make_tuple(boost::system::error_code{}))));
+            }
+
+            if (!vm_ctx->valid())
+                return;
+
+            if (wheel->size > 0) {
+                arm_coarse_timer_wheel(wheel, vm_ctx);
+            } else {
+                wheel->running = false;
+                vm_ctx->pending_operations.erase(
+                    vm_ctx->pending_operations.iterator_to(*wheel));
+            }
+        }
+    ));
+}
+
+static int coarse_sleep_for(lua_State* L)
+{
+    lua_Number secs = luaL_checknumber(L, 1);
+    if (std::isnan(secs) || std::isinf(secs) || secs < 0) {
+        push(L, std::errc::argument_out_of_domain, "arg", 1);
+        return lua_error(L);
+    }
+
+    lua_Seconds dur{secs};
+    // leaves room for `now + dur`
+    if (dur > std::chrono::steady_clock::duration::max() / 2) {
+        push(L, std::errc::value_too_large);
+        return lua_error(L);
+    }
+
+    auto vm_ctx = get_vm_context(L).shared_from_this();
+    auto current_fiber = vm_ctx->current_fiber();
+    EMILUA_CHECK_SUSPEND_ALLOWED(*vm_ctx, L);
+
+    auto& wheel = get_coarse_timer_wheel(L, *vm_ctx);
+    auto now = std::chrono::steady_clock::now();
+    if (!wheel->running) {
+        wheel->origin = now;
+        wheel->current_tick = 0;
+    }
+
+    // rounded up so sleepers never wake up early
+    auto expiry = now +
+        std::chrono::ceil<std::chrono::steady_clock::duration>(dur);
+    auto expiry_tick = wheel->ticks_since_origin(expiry);
+    if (wheel->origin + wheel->granularity * expiry_tick < expiry)
+        ++expiry_tick;
+    expiry_tick = std::max(expiry_tick, wheel->current_tick + 1);
+
+    auto& e = wheel->acquire_entry();
+    e.fiber = current_fiber;
+    e.expiry_tick = expiry_tick;
+    wheel->slots[expiry_tick % EMILUA_IMPL_COARSE_TIMER_WHEEL_SLOTS]
+        .push_back(e);
+    ++wheel->size;
+
+    lua_pushlightuserdata(L, &e);
+    lua_pushnumber(L, static_cast<lua_Number>(e.generation));
+    lua_pushcclosure(
+        L,
+        [](lua_State* L) -> int {
+            auto e = static_cast<coarse_timer_wheel::entry*>(
+                lua_touserdata(L, lua_upvalueindex(1)));
+            auto generation = static_cast<std::uint64_t>(
+                lua_tonumber(L, lua_upvalueindex(2)));
+            if (e->generation != generation)
+                return 0;
+
+            auto vm_ctx = get_vm_context(L).shared_from_this();
+            lua_State* fiber = e->fiber;
+            get_coarse_timer_wheel(L, *vm_ctx)->release_entry(*e);
+            vm_ctx->strand().post([vm_ctx,fiber]() {
+                auto opt_args = vm_context::options::arguments;
+                vm_ctx->fiber_resume(
+                    fiber,
+                    hana::make_set(
+                        vm_context::options::fast_auto_detect_interrupt,
+                        hana::make_pair(
+                            opt_args,
+                            hana::make_tuple(boost::system::error_code{
+                                asio::error::operation_aborted}))));
+            }, std::allocator<void>{});
+            return 0;
+        },
+        2);
+    set_interrupter(L, *vm_ctx);
+
+    if (!wheel->running) {
+        wheel->running = true;
+        vm_ctx->pending_operations.push_back(*wheel);
+        arm_coarse_timer_wheel(wheel, vm_ctx);
+    }
+
+    return lua_yield(L, 0);
+}
+
+static int set_coarse_granularity(lua_State* L)
+{
+    lua_Number secs = luaL_checknumber(L, 1);
+    if (!(secs >= 0.001) || secs > 1) {
+        push(L, std::errc::argument_out_of_domain, "arg", 1);
+        return lua_error(L);
+    }
+
+    // an armed wheel keeps counting `current_tick` in units of the old
+    // granularity until its timer fires and finds no sleepers left
+    auto& wheel = get_coarse_timer_wheel(L, get_vm_context(L));
+    if (wheel->size > 0 || wheel->running) {
+        push(L, std::errc::device_or_resource_busy);
+        return lua_error(L);
+    }
+
+    wheel->granularity =
+        std::chrono::ceil<std::chrono::steady_clock::duration>(
+            lua_Seconds{secs});
+    return 0;
+}
+
 EMILUA_GPERF_DECLS_BEGIN(time)
 EMILUA_GPERF_NAMESPACE(emilua)
 template<class Clock>
@@ -216,6 +523,14 @@ inline int steady_clock_time_point_seconds_since_epoch(lua_State* L)
     lua_pushnumber(L, lua_Seconds{tp->time_since_epoch()}.count());
     return 1;
 }
+
+inline int steady_clock_time_point_nanoseconds_since_epoch(lua_State* L)
+{
+    auto tp = static_cast<std::chrono::steady_clock::time_point*>(
+        lua_touserdata(L, 1));
+    lua_pushnumber(L, to_lua_nanoseconds(tp->time_since_epoch()));
+    return 1;
+}
 EMILUA_GPERF_DECLS_END(steady_clock_time_point)
 
 static int steady_clock_time_point_mt_index(lua_State* L)
@@ -241,6 +556,9 @@ static int steady_clock_time_point_mt_index(lua_State* L)
             })
         EMILUA_GPERF_PAIR(
             "seconds_since_epoch", steady_clock_time_point_seconds_since_epoch)
+        EMILUA_GPERF_PAIR(
+            "nanoseconds_since_epoch",
+            steady_clock_time_point_nanoseconds_since_epoch)
     EMILUA_GPERF_END(key)(L);
 }
 
@@ -466,6 +784,30 @@ static int steady_clock_now(lua_State* L)
     return 1;
 }
 
+static int steady_clock_now_ns(lua_State* L)
+{
+    lua_pushnumber(
+        L,
+        to_lua_nanoseconds(
+            std::chrono::steady_clock::now().time_since_epoch()));
+    return 1;
+}
+
+static int steady_clock_coarse_now_ns(lua_State* L)
+{
+#if BOOST_OS_LINUX
+    // libstdc++ and libc++ both implement steady_clock on top of
+    // CLOCK_MONOTONIC so the epochs match
+    lua_pushnumber(L, coarse_clock_nanoseconds(CLOCK_MONOTONIC_COARSE));
+#else // BOOST_OS_LINUX
+    lua_pushnumber(
+        L,
+        to_lua_nanoseconds(
+            std::chrono::steady_clock::now().time_since_epoch()));
+#endif // BOOST_OS_LINUX
+    return 1;
+}
+
 EMILUA_GPERF_DECLS_BEGIN(high_resolution_clock_time_point)
 EMILUA_GPERF_NAMESPACE(emilua)
 inline int high_resolution_clock_time_point_seconds_since_epoch(lua_State* L)
@@ -924,6 +1266,14 @@ inline int system_clock_time_point_seconds_since_epoch(lua_State* L)
     lua_pushnumber(L, lua_Seconds{tp->time_since_epoch()}.count());
     return 1;
 }
+
+inline int system_clock_time_point_nanoseconds_since_epoch(lua_State* L)
+{
+    auto tp = static_cast<std::chrono::system_clock::time_point*>(
+        lua_touserdata(L, 1));
+    lua_pushnumber(L, to_lua_nanoseconds(tp->time_since_epoch()));
+    return 1;
+}
 EMILUA_GPERF_DECLS_END(system_clock_time_point)
 
 static int system_clock_time_point_mt_index(lua_State* L)
@@ -949,6 +1299,9 @@ static int system_clock_time_point_mt_index(lua_State* L)
             })
         EMILUA_GPERF_PAIR(
             "seconds_since_epoch", system_clock_time_point_seconds_since_epoch)
+        EMILUA_GPERF_PAIR(
+            "nanoseconds_since_epoch",
+            system_clock_time_point_nanoseconds_since_epoch)
     EMILUA_GPERF_END(key)(L);
 }
 
@@ -1174,6 +1527,28 @@ static int system_clock_now(lua_State* L)
     return 1;
 }
 
+static int system_clock_now_ns(lua_State* L)
+{
+    lua_pushnumber(
+        L,
+        to_lua_nanoseconds(
+            std::chrono::system_clock::now().time_since_epoch()));
+    return 1;
+}
+
+static int system_clock_coarse_now_ns(lua_State* L)
+{
+#if BOOST_OS_LINUX
+    lua_pushnumber(L, coarse_clock_nanoseconds(CLOCK_REALTIME_COARSE));
+#else // BOOST_OS_LINUX
+    lua_pushnumber(
+        L,
+        to_lua_nanoseconds(
+            std::chrono::system_clock::now().time_since_epoch()));
+#endif // BOOST_OS_LINUX
+    return 1;
+}
+
 static int system_timer_wait(lua_State* L)
 {
     auto vm_ctx = get_vm_context(L).shared_from_this();
@@ -1479,11 +1854,15 @@ void init_time(lua_State* L)
 
     lua_pushlightuserdata(L, &time_key);
     {
-        lua_createtable(L, /*narr=*/0, /*nrec=*/6);
+        lua_createtable(L, /*narr=*/0, /*nrec=*/8);
+
+        lua_pushliteral(L, "set_coarse_granularity");
+        lua_pushcfunction(L, set_coarse_granularity);
+        lua_rawset(L, -3);
 
         lua_pushliteral(L, "steady_clock");
         {
-            lua_createtable(L, /*narr=*/0, /*nrec=*/2);
+            lua_createtable(L, /*narr=*/0, /*nrec=*/4);
 
             lua_pushliteral(L, "epoch");
             lua_pushcfunction(L, steady_clock_epoch);
@@ -1492,6 +1871,14 @@ void init_time(lua_State* L)
             lua_pushliteral(L, "now");
             lua_pushcfunction(L, steady_clock_now);
             lua_rawset(L, -3);
+
+            lua_pushliteral(L, "now_ns");
+            lua_pushcfunction(L, steady_clock_now_ns);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "coarse_now_ns");
+            lua_pushcfunction(L, steady_clock_coarse_now_ns);
+            lua_rawset(L, -3);
         }
         lua_rawset(L, -3);
 
@@ -1507,7 +1894,7 @@ void init_time(lua_State* L)
 
         lua_pushliteral(L, "system_clock");
         {
-            lua_createtable(L, /*narr=*/0, /*nrec=*/2);
+            lua_createtable(L, /*narr=*/0, /*nrec=*/4);
 
             lua_pushliteral(L, "epoch");
             lua_pushcfunction(L, system_clock_epoch);
@@ -1516,6 +1903,14 @@ void init_time(lua_State* L)
             lua_pushliteral(L, "now");
             lua_pushcfunction(L, system_clock_now);
             lua_rawset(L, -3);
+
+            lua_pushliteral(L, "now_ns");
+            lua_pushcfunction(L, system_clock_now_ns);
+            lua_rawset(L, -3);
+
+            lua_pushliteral(L, "coarse_now_ns");
+            lua_pushcfunction(L, system_clock_coarse_now_ns);
+            lua_rawset(L, -3);
         }
         lua_rawset(L, -3);
 
@@ -1565,6 +1960,13 @@ void init_time(lua_State* L)
             lua_call(L, 2, 1);
             lua_rawset(L, LUA_REGISTRYINDEX);
 
+            lua_pushliteral(L, "coarse_sleep");
+            lua_pushvalue(L, -2);
+            rawgetp(L, LUA_REGISTRYINDEX, &raw_error_key);
+            lua_pushcfunction(L, coarse_sleep_for);
+            lua_call(L, 2, 1);
+            lua_rawset(L, -4);
+
             lua_pushliteral(L, "sleep");
             lua_insert(L, -2);
             rawgetp(L, LUA_REGISTRYINDEX, &raw_error_key);
@@ -0,0 +1,22 @@
+-- VMs hosted on the shared context
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    for i = 1, 4 do
+        local ch = spawn_vm{ module = '.', shared_context = true }
+        ch:send{ from = inbox, body = i }
+    end
+
+    local sum = 0
+    for _ = 1, 4 do
+        sum = sum + inbox:receive()
+    end
+    print(sum)
+else assert(_CONTEXT == 'worker')
+    -- the shared context has a fixed number of threads
+    assert(not pcall(spawn_context_threads, 1))
+
+    local m = inbox:receive()
+    m.from:send(m.body * 10)
+end
@@ -0,0 +1,3 @@
+if _CONTEXT == 'main' then
+    spawn_vm{ module = '.', inherit_context = true, shared_context = true }
+end
@@ -0,0 +1,5 @@
+-- CPU placement only applies to the thread of a new context
+
+if _CONTEXT == 'main' then
+    spawn_vm{ module = '.', cpus = { 0 } }
+end
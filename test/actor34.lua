@@ -0,0 +1,24 @@
+-- Preemption budget for fibers that never suspend
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    -- fractional budgets are rejected instead of truncated
+    assert(not pcall(spawn_vm, { module = '.', preemption_budget = 1000.5 }))
+
+    local ch = spawn_vm{ module = '.', preemption_budget = 1000 }
+    ch:send(inbox)
+    print(inbox:receive())
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+
+    -- compiled traces would skip the budget check
+    assert(not jit.status())
+
+    local done = false
+    spawn(function() done = true end):detach()
+
+    -- without preemption the fiber above would never get the chance to run
+    while not done do end
+    master:send(this_vm.stats().preemptions > 0)
+end
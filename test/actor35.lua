@@ -0,0 +1,22 @@
+-- Hard memory limit for actors
+
+local inbox = require('inbox')
+
+local limit = 32 * 1024 * 1024
+
+if _CONTEXT == 'main' then
+    local ch = spawn_vm{ module = '.', memory_limit = limit }
+    ch:send(inbox)
+    print(inbox:receive())
+    ch:send('go')
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+    local stats = this_vm.stats()
+    master:send(stats.heap_size > 0 and stats.peak_heap_size <= limit)
+    inbox:receive()
+
+    local t = {}
+    for i = 1, math.huge do
+        t[i] = {}
+    end
+end
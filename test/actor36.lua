@@ -0,0 +1,25 @@
+-- VMs handed out from a warm pool
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    local sum = 0
+    for i = 1, 5 do
+        local ch = spawn_vm{ module = '.', warm_pool = 2 }
+        ch:send(inbox)
+        ch:send(i)
+        sum = sum + inbox:receive()
+        this_fiber.yield()
+    end
+    print(sum)
+
+    assert(not pcall(function()
+        spawn_vm{ module = '.', warm_pool = 0 }
+    end))
+    assert(not pcall(function()
+        spawn_vm{ module = '.', warm_pool = 2, inherit_context = false }
+    end))
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+    master:send(inbox:receive() * 10)
+end
@@ -0,0 +1,34 @@
+-- byte_spans sent to VMs of the same process are moved when nothing else
+-- references their buffer and copied otherwise
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    local ch = spawn_vm('.')
+    local buf = byte_span.new(3, 8)
+    buf:copy('abc')
+    ch:send{ master = inbox, buf = buf }
+    print(#buf, buf.capacity)
+
+    local reply = inbox:receive()
+    print(tostring(reply), #reply, reply.capacity)
+
+    buf = byte_span.new(3, 8)
+    buf:copy('abc')
+    local slice = buf:slice(2, 3)
+    ch:send{ buf = buf, list = { slice } }
+    print(tostring(buf), buf.capacity, tostring(slice))
+
+    reply = inbox:receive()
+    print(tostring(reply[1]), reply[1].capacity)
+    print(tostring(reply[2]), reply[2].capacity)
+    print(tostring(buf))
+else assert(_CONTEXT == 'worker')
+    local msg = inbox:receive()
+    local master = msg.master
+    master:send(msg.buf)
+
+    msg = inbox:receive()
+    msg.buf[3] = 67
+    master:send{ msg.buf, msg.list[1] }
+end
@@ -0,0 +1,30 @@
+-- inbox:receive_many()
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    local ch = spawn_vm('.')
+    ch:send(inbox)
+
+    print((pcall(function() inbox:receive_many(0) end)))
+
+    local got = {}
+    while #got < 5 do
+        local batch = inbox:receive_many(3)
+        assert(#batch >= 1 and #batch <= 3)
+        for _, v in ipairs(batch) do
+            got[#got + 1] = v
+        end
+    end
+    table.sort(got)
+    print(table.concat(got, ' '))
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+    local fibers = {}
+    for i = 1, 5 do
+        fibers[i] = spawn(function() master:send(i) end)
+    end
+    for _, f in ipairs(fibers) do
+        f:join()
+    end
+end
@@ -0,0 +1,37 @@
+-- bounded inboxes and try_send()
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    local ch = spawn_vm('.')
+    ch:send(inbox)
+    local self = inbox:receive()
+
+    inbox:set_capacity(2, 'drop_oldest')
+    for i = 1, 5 do
+        assert(self:try_send(i))
+    end
+    this_fiber.yield()
+    print(inbox.size, inbox.capacity, inbox.dropped)
+    print(table.concat(inbox:receive_many(10), ' '))
+
+    inbox:set_capacity(2, 'drop_newest')
+    for i = 1, 3 do
+        assert(self:try_send(i))
+    end
+    this_fiber.yield()
+    print(table.concat(inbox:receive_many(10), ' '), inbox.dropped)
+
+    inbox:set_capacity(1, 'fail')
+    print(self:try_send('a'))
+    this_fiber.yield()
+    print(self:try_send('b'))
+    print(inbox:receive())
+
+    inbox:set_capacity(nil)
+    print(inbox.capacity)
+    self:close()
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+    master:send(master)
+end
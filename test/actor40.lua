@@ -0,0 +1,35 @@
+-- broadcast
+
+local inbox = require('inbox')
+
+if _CONTEXT == 'main' then
+    local broadcast = require('broadcast')
+    local b = broadcast.new()
+
+    local w1 = spawn_vm('.')
+    local w2 = spawn_vm('.')
+    b:subscribe(w1)
+    b:subscribe(w2)
+    b:subscribe(w1)
+    print(b.subscribers)
+
+    local buf = byte_span.new(3)
+    buf:copy('abc')
+    local slice = buf:slice(1, 1)
+    print(b:publish{ n = 1, list = { 'a', 'b' }, buf = buf })
+    print(b:lag(w1))
+
+    w1:send(inbox)
+    w2:send(inbox)
+    print(inbox:receive())
+    print(inbox:receive())
+    print(b:lag(w1), b:lag(w2))
+    print(tostring(buf), tostring(slice))
+else assert(_CONTEXT == 'worker')
+    local msg = inbox:receive()
+    local master = inbox:receive()
+    -- subscribers don't see each other's writes
+    local before = tostring(msg.buf)
+    msg.buf[1] = 88
+    master:send((msg.n + #msg.list) .. ' ' .. before)
+end
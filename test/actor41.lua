@@ -0,0 +1,15 @@
+-- CPU placement is applied to the thread of the new context (and inherited
+-- by processes spawned from it)
+local system = require 'system'
+
+if _CONTEXT == 'main' then
+    spawn_vm{ module = '.', inherit_context = false, cpus = { 0 } }
+else
+    local p = system.spawn{
+        program = 'grep',
+        arguments = { 'grep', 'Cpus_allowed_list', '/proc/self/status' },
+        environment = system.environment,
+        stdout = 'share'
+    }
+    p:wait()
+end
@@ -0,0 +1,42 @@
+-- "block" and "fail" overflow policies
+
+local inbox = require('inbox')
+local time = require('time')
+
+if _CONTEXT == 'main' then
+    inbox:set_capacity(2, 'block')
+    local ch = spawn_vm('.')
+    ch:send(inbox)
+
+    while inbox.blocked_senders < 3 do
+        time.sleep(0.01)
+    end
+    print(inbox.size, inbox.blocked_senders)
+
+    -- every receive() lets the oldest blocked sender in
+    for _ = 1, 5 do
+        print(inbox:receive(), inbox.size, inbox.blocked_senders)
+    end
+
+    inbox:set_capacity(1, 'fail')
+    ch:send('fail')
+    while inbox.dropped < 1 do
+        time.sleep(0.01)
+    end
+    print(inbox.size, inbox.dropped)
+    print(inbox:receive())
+    ch:send('go')
+    print(inbox:receive() == 11) --< EAGAIN
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+    for i = 1, 5 do
+        spawn(function() master:send(i) end)
+    end
+
+    assert(inbox:receive() == 'fail')
+    assert(master:try_send('a'))
+    local ok, e = pcall(function() master:send('b') end)
+    assert(not ok)
+    assert(inbox:receive() == 'go')
+    master:send(e.code)
+end
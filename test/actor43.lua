@@ -0,0 +1,29 @@
+-- a message sent right before the last sender goes away is still received
+-- (instead of `no_senders`)
+
+local inbox = require('inbox')
+
+local function busy_wait(secs)
+    local deadline = os.clock() + secs
+    while os.clock() < deadline do end
+end
+
+if _CONTEXT == 'main' then
+    local ch = spawn_vm{ module = '.', inherit_context = false }
+    ch:send(inbox)
+    -- don't yield so the delivery is still in flight when we call receive()
+    busy_wait(0.2)
+    print(inbox:receive())
+
+    ch = spawn_vm{ module = '.', inherit_context = false }
+    ch:send(inbox)
+    busy_wait(0.2)
+    print(table.concat(inbox:receive_many(10), ' '))
+
+    -- no senders left
+    print((pcall(function() return inbox:receive() end)))
+else assert(_CONTEXT == 'worker')
+    local master = inbox:receive()
+    master:try_send('last words')
+    master:close()
+end
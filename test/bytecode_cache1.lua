@@ -0,0 +1,71 @@
+-- EMILUA_BYTECODE_CACHE: hits, invalidation and entries that don't match the
+-- module being loaded
+
+local fs = require 'filesystem'
+local system = require 'system'
+
+local fixtures = _FILE.parent_path / 'bytecode_cache1_foo'
+local workdir = fs.temp_directory_path() /
+    ('emilua-bytecode_cache1-' .. system.getpid())
+local cachedir = workdir / 'cache'
+local module = workdir / 'init.lua'
+fs.create_directories(cachedir)
+
+local env = {}
+for k, v in pairs(system.environment) do
+    env[k] = v
+end
+env.EMILUA_BYTECODE_CACHE = tostring(cachedir)
+
+local function run()
+    local p = system.spawn{
+        program = fs.path.new(env.EMILUA_BIN),
+        arguments = { 'emilua', tostring(module) },
+        environment = env,
+        stdout = 'share',
+        stderr = 'share'
+    }
+    p:wait()
+    assert(p.exit_code == 0)
+end
+
+local function entries()
+    local ret = {}
+    for entry in fs.directory_iterator(cachedir) do
+        if entry.path.extension == '.ljbc' then
+            ret[#ret + 1] = entry.path
+        end
+    end
+    return ret
+end
+
+fs.copy_file(fixtures / 'v1.lua', module)
+run()
+local v1 = entries()
+assert(#v1 == 1)
+v1 = v1[1]
+
+-- a hit leaves the entry alone (a miss would rename() a new file over it)
+fs.create_hard_link(v1, workdir / 'v1.ljbc')
+run()
+assert(fs.hard_link_count(v1) == 2)
+
+-- new contents never hit the old entry
+fs.copy_file(fixtures / 'v2.lua', module, { existing = 'overwrite' })
+run()
+local v2
+for _, p in ipairs(entries()) do
+    if tostring(p) ~= tostring(v1) then
+        v2 = p
+    end
+end
+assert(v2)
+
+-- an entry whose stored source doesn't match is ignored (even if it's found
+-- under the right name)
+fs.copy_file(fixtures / 'v1.lua', module, { existing = 'overwrite' })
+fs.remove(v1)
+fs.copy_file(v2, v1)
+run()
+
+fs.remove_all(workdir)
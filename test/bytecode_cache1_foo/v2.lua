@@ -0,0 +1 @@
+print('v2')
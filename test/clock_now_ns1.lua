@@ -0,0 +1,16 @@
+local time = require('time')
+
+for _, clock in ipairs{time.steady_clock, time.system_clock} do
+    local a = clock.now().nanoseconds_since_epoch
+    local b = clock.now_ns()
+    assert(type(b) == 'number' and b >= a)
+
+    -- the coarse clock lags behind by at most a few kernel ticks
+    local c = clock.coarse_now_ns()
+    assert(type(c) == 'number')
+    assert(math.abs(clock.now_ns() - c) < 1e9)
+end
+
+local start = time.steady_clock.now_ns()
+time.sleep(0.05)
+print(time.steady_clock.now_ns() - start >= 0.05e9)
@@ -0,0 +1,37 @@
+local time = require('time')
+
+local function now()
+    return time.steady_clock.now().seconds_since_epoch
+end
+
+time.set_coarse_granularity(0.005)
+
+local order = {}
+local fibers = {}
+for _, secs in ipairs{0.03, 0.01, 0.02} do
+    fibers[#fibers + 1] = spawn(function()
+        local start = now()
+        time.coarse_sleep(secs)
+        assert(now() - start >= secs)
+        order[#order + 1] = secs
+    end)
+end
+
+-- interrupted sleepers leave the wheel right away
+local f = spawn(function() time.coarse_sleep(60) end)
+this_fiber.yield()
+f:interrupt()
+f:join()
+print(f.interruption_caught)
+
+assert(not pcall(time.set_coarse_granularity, 0.01))
+
+for _, f in ipairs(fibers) do
+    f:join()
+end
+print(table.concat(order, ' '))
+
+-- the wheel only disarms on its next tick
+time.sleep(0.01)
+time.set_coarse_granularity(0.01)
+assert(not pcall(time.set_coarse_granularity, 2))
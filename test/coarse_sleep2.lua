@@ -0,0 +1,24 @@
+local time = require('time')
+
+local function now()
+    return time.steady_clock.now().seconds_since_epoch
+end
+
+time.set_coarse_granularity(0.005)
+
+-- the interrupted sleeper leaves the wheel but its timer stays armed
+local f = spawn(function() time.coarse_sleep(60) end)
+this_fiber.yield()
+f:interrupt()
+f:join()
+local ok, e = pcall(time.set_coarse_granularity, 0.01)
+print(ok, e.code == 16) --< EBUSY
+
+-- once the armed tick fires, the wheel disarms
+time.sleep(0.02)
+time.set_coarse_granularity(0.01)
+
+local start = now()
+time.coarse_sleep(0.03)
+assert(now() - start >= 0.03)
+print('done')
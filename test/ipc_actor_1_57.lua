@@ -0,0 +1,28 @@
+-- ring transport keeps ordering with messages carrying descriptors
+local system = require 'system'
+local inbox = require 'inbox'
+
+if _CONTEXT ~= 'main' then
+    print(inbox:receive())
+    print(inbox:receive())
+    print(inbox:receive())
+    local ch = inbox:receive()
+    print(inbox:receive().x)
+    ch:send('done')
+else
+    local my_channel = spawn_vm{
+        module = tostring(_FILE),
+        subprocess = {
+            stdout = 'share',
+            stderr = 'share',
+            environment = system.environment,
+            ring_size = 65536
+        }
+    }
+    my_channel:send('hello')
+    my_channel:send(42)
+    my_channel:send(true)
+    my_channel:send(inbox)
+    my_channel:send{ x = 'world' }
+    print(inbox:receive())
+end
@@ -0,0 +1,49 @@
+-- ring transport under backpressure: the ring wraps several times, the sender
+-- waits for room and descriptors still arrive in order
+local system = require 'system'
+local inbox = require 'inbox'
+local time = require 'time'
+
+local N = 400
+
+local function payload(i)
+    return string.rep(string.char(65 + i % 26), 100 + i % 150)
+end
+
+if _CONTEXT ~= 'main' then
+    -- let the sender fill the ring up
+    time.sleep(0.5)
+
+    local chs = {}
+    for i = 1, N do
+        local m = inbox:receive()
+        assert(m.i == i)
+        if i % 40 == 0 then
+            assert(m.s == nil)
+            chs[#chs + 1] = m.ch
+        else
+            assert(m.ch == nil)
+            assert(m.s == payload(i))
+        end
+    end
+    print(#chs)
+    chs[#chs]:send('done')
+else
+    local my_channel = spawn_vm{
+        module = tostring(_FILE),
+        subprocess = {
+            stdout = 'share',
+            stderr = 'share',
+            environment = system.environment,
+            ring_size = 32768
+        }
+    }
+    for i = 1, N do
+        if i % 40 == 0 then
+            my_channel:send{ i = i, ch = inbox }
+        else
+            my_channel:send{ i = i, s = payload(i) }
+        end
+    end
+    print(inbox:receive())
+end
@@ -0,0 +1,45 @@
+-- ring transport with several multi-descriptor records in flight: the
+-- consumer may read the descriptors of later records before it pops them
+local system = require 'system'
+local inbox = require 'inbox'
+
+local N = 50
+local NFDS = 19
+
+if _CONTEXT ~= 'main' then
+    local last
+    for i = 1, 2 * N do
+        local m = inbox:receive()
+        assert(m.i == i)
+        if i % 2 == 1 then
+            for j = 1, NFDS do
+                m['c' .. j]:close()
+            end
+        else
+            if last then
+                last:close()
+            end
+            last = m.c1
+            assert(m.c2 == nil)
+        end
+    end
+    last:send('done')
+else
+    local my_channel = spawn_vm{
+        module = tostring(_FILE),
+        subprocess = {
+            stdout = 'share',
+            stderr = 'share',
+            environment = system.environment,
+            ring_size = 32768
+        }
+    }
+    for i = 1, 2 * N do
+        local m = { i = i }
+        for j = 1, (i % 2 == 1) and NFDS or 1 do
+            m['c' .. j] = inbox
+        end
+        my_channel:send(m)
+    end
+    print(inbox:receive())
+end
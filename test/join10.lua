@@ -0,0 +1,31 @@
+-- Finished fibers are recycled by later spawn() calls. This test ensures a
+-- recycled fiber doesn't carry state over from its previous life.
+
+local function f(i)
+    print(i, this_fiber.local_.x)
+    this_fiber.local_.x = i
+    scope_cleanup_push(function() print('cleanup', i) end)
+    this_fiber.disable_interruption()
+    this_fiber.forbid_suspend()
+    return i * 2
+end
+
+for i = 1, 3 do
+    -- joined after it finished
+    local fib = spawn(function() return f(i) end)
+    this_fiber.yield()
+    print(fib:join())
+end
+
+for i = 4, 5 do
+    -- joined while still running
+    print(spawn(function() return f(i) end):join())
+end
+
+local fib = spawn(function()
+    this_fiber.yield()
+    print('unreachable')
+end)
+fib:interrupt()
+fib:join()
+print(fib.interruption_caught)
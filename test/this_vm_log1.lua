@@ -0,0 +1,8 @@
+this_vm.log(3, 'hello')
+
+-- above the default log level
+this_vm.log(7, 'ignored')
+
+print(this_vm.log_dropped())
+assert(not pcall(this_vm.log, 8, 'out of range'))
+assert(not pcall(this_vm.log, 3))
@@ -0,0 +1,62 @@
+-- EMILUA_LOG_SINK=async-json truncates long messages without breaking the
+-- JSON record
+
+local stream = require 'stream'
+local system = require 'system'
+local json = require 'json'
+local pipe = require 'pipe'
+local fs = require 'filesystem'
+
+local long_message = string.rep('"\195\169', 400)
+
+if system.environment.EMILUA_TEST_LOG_CHILD then
+    this_vm.log(3, long_message)
+    this_vm.log(3, 'short')
+    return
+end
+
+local env = {}
+for k, v in pairs(system.environment) do
+    env[k] = v
+end
+env.EMILUA_LOG_SINK = 'async-json'
+env.EMILUA_TEST_LOG_CHILD = '1'
+
+local pin, pout = pipe.pair()
+pout = pout:release()
+
+local p = system.spawn{
+    program = fs.path.new(env.EMILUA_BIN),
+    arguments = { 'emilua', tostring(_FILE) },
+    environment = env,
+    stdout = 'share',
+    stderr = pout
+}
+pout:close()
+
+local output = {}
+local buf = byte_span.new(1024)
+while true do
+    local ok, nread = pcall(pin.read_some, pin, buf)
+    if not ok then
+        break
+    end
+    output[#output + 1] = tostring(buf:slice(1, nread))
+end
+output = table.concat(output)
+
+p:wait()
+assert(p.exit_code == 0)
+
+for line in output:gmatch('([^\n]*)\n') do
+    assert(#line + 1 <= 512)
+    local record = json.decode(line)
+    local message = record.message
+    if #message < #long_message then
+        -- a prefix that ends at a character boundary
+        assert(long_message:sub(1, #message) == message)
+        assert(message:match('"\195\169$') or message:match('"$'))
+        message = 'truncated'
+    end
+    print(record.priority, record.domain, message)
+end
@@ -0,0 +1,57 @@
+-- busy loops below must not be compiled away
+
+local time = require('time')
+
+local function now()
+    return time.steady_clock.now().seconds_since_epoch
+end
+
+local function fiber_roots()
+    local roots = {}
+    for line in this_vm.profile():gmatch('[^\n]+') do
+        local root = line:match('^(fiber %d+)[; ]')
+        if root then
+            roots[root] = true
+        end
+    end
+    local n = 0
+    for _ in pairs(roots) do
+        n = n + 1
+    end
+    return n
+end
+
+-- fail instead of hanging if samples never show up
+local function spin_until(pred)
+    local deadline = now() + 10
+    repeat
+        for _ = 1, 100000 do end
+    until pred() or now() > deadline
+    assert(pred())
+end
+
+this_vm.start_profiler(0.001)
+spin_until(function() return this_vm.profile() ~= '' end)
+
+-- the second fiber reuses the first one's coroutine, but it still gets its own
+-- root frame
+for i = 1, 2 do
+    spawn(function()
+        spin_until(function() return fiber_roots() >= i end)
+    end):join()
+end
+this_vm.stop_profiler()
+
+local profile = this_vm.profile()
+for line in profile:gmatch('[^\n]+') do
+    local stack, samples = line:match('^(.+) (%d+)$')
+    assert(tonumber(samples) > 0)
+
+    -- samples taken from the main fiber are attributed to the entry point
+    local root = stack:match('^[^;]+')
+    assert(root:find('this_vm_profile1.lua', 1, true) or
+           root:find('^fiber %d+$'), root)
+end
+
+for _ = 1, 100000 do end
+print(profile == this_vm.profile())
@@ -0,0 +1,26 @@
+print(this_vm.stats().live_fibers)
+
+local f = spawn(function() end)
+spawn(function() this_fiber.yield() end):detach()
+print(this_vm.stats().live_fibers)
+
+this_fiber.yield()
+this_fiber.yield()
+f:join()
+print(this_vm.stats().live_fibers)
+
+local stats = this_vm.stats()
+print(stats.resumes > 0, stats.run_time >= 0, stats.queue_delay_samples > 0)
+print(#stats.run_time_histogram, #stats.queue_delay_histogram)
+
+local nsamples = 0
+for _, v in ipairs(stats.run_time_histogram) do
+    nsamples = nsamples + v
+end
+print(nsamples == stats.resumes)
+
+nsamples = 0
+for _, v in ipairs(stats.queue_delay_histogram) do
+    nsamples = nsamples + v
+end
+print(nsamples == stats.queue_delay_samples)